@@ -0,0 +1,546 @@
+/*
+ * FmDemodBench.cpp
+ *
+ * Throughput of every stage of the demodulation on its own and of the whole pipeline,
+ * on a synthetic FM stereo broadcast.
+ *
+ * Usage: FmDemodBench [--rate <SDR rate>] [--audio-rate <rate>] [--block <IQ samples>]
+ *                     [--time <seconds per stage>] [--float] [--json]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include "Complex.h"
+#include "DataBuffer.h"
+#include "BufferPool.h"
+#include "IqConverter.h"
+#include "Nco.h"
+#include "LowPass.h"
+#include "RationalResampler.h"
+#include "QuadratureDiscriminator.h"
+#include "StereoDecoder.h"
+#include "PolyphaseChannelizer.h"
+#include "FmDemodulator.h"
+#include "FmMultiDemodulator.h"
+#include "FmFileDemodulator.h"
+#include "FmSyncDemodulator.h"
+
+// Heap allocations of the whole process, the buffer pools allocate through aligned_alloc and count their own
+static std::atomic<uint64_t> heapAllocations(0);
+
+// Every form of allocation is replaced and counted, and every form of release frees, so any new pairs with
+// any delete. None of them is inlined: GCC would otherwise see `free` or an aligned delete applied to the
+// result of `malloc` and report a mismatch (-Wmismatched-new-delete)
+static void *countedAllocation(size_t size, size_t alignment) noexcept
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (alignment <= alignof(std::max_align_t))
+    {
+        return malloc(size);
+    }
+    // aligned_alloc takes a multiple of the alignment
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void *checkedAllocation(size_t size, size_t alignment)
+{
+    if (void *p = countedAllocation(size, alignment))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    return checkedAllocation(size, alignof(std::max_align_t));
+}
+
+__attribute__((noinline)) void *operator new[](size_t size)
+{
+    return checkedAllocation(size, alignof(std::max_align_t));
+}
+
+__attribute__((noinline)) void *operator new(size_t size, std::align_val_t alignment)
+{
+    return checkedAllocation(size, (size_t)alignment);
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return checkedAllocation(size, (size_t)alignment);
+}
+
+__attribute__((noinline)) void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAllocation(size, alignof(std::max_align_t));
+}
+
+__attribute__((noinline)) void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return countedAllocation(size, (size_t)alignment);
+}
+
+__attribute__((noinline)) void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return countedAllocation(size, (size_t)alignment);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+struct Config
+{
+    int sampleRate = 2400000;
+    int audioSampleRate = 48000;
+    size_t block = 262144;
+    double seconds = 1.0;
+    bool single = false;
+    bool json = false;
+};
+
+struct Result
+{
+    std::string stage;
+    // Rate of the samples entering the stage in the real-time pipeline
+    double streamRate;
+    uint64_t samples;
+    uint64_t blocks;
+    uint64_t allocations;
+    double elapsed;
+};
+
+/**
+ * @brief Interleaved unsigned 8 bit IQ samples of an FM stereo broadcast: a 1 kHz tone on the left,
+ * 1.7 kHz on the right, the 19 kHz pilot and some noise
+ */
+static std::vector<uint8_t> generateFm(int sampleRate, size_t samples, int offset)
+{
+    std::vector<uint8_t> iq(2 * samples);
+    double phase = 0;
+    uint32_t seed = 1;
+    for (size_t n = 0; n < samples; n++)
+    {
+        double t = (double)n / sampleRate;
+        double left = sin(2 * M_PI * 1000 * t);
+        double right = sin(2 * M_PI * 1700 * t);
+        // ITU-R BS.450: the subcarrier is the second harmonic of the pilot, both sines
+        double mpx = 0.45 * (left + right) / 2 + 0.45 * (left - right) / 2 * sin(2 * M_PI * 38000 * t) +
+                     0.09 * sin(2 * M_PI * 19000 * t);
+        phase = remainder(phase + 2 * M_PI * (offset + 75000 * mpx) / sampleRate, 2 * M_PI);
+        seed = seed * 1103515245 + 12345;
+        double noise = (double)((seed >> 16) & 0xff) / 128.0 - 1.0;
+        iq[2 * n] = (uint8_t)lround(127.5 + 100 * cos(phase) + noise);
+        iq[2 * n + 1] = (uint8_t)lround(127.5 + 100 * sin(phase) + noise);
+    }
+    return iq;
+}
+
+/**
+ * @brief Run `step` on consecutive blocks until the time of the stage is over
+ *
+ * @param step Processes one block and returns the number of input samples it took
+ * @param pool Pool of the stage outputs, or nullptr
+ */
+static Result measure(const Config &config, const std::string &stage, double streamRate,
+                      const std::function<size_t()> &step, const BufferPool *pool = nullptr)
+{
+    // The first block fills the pools and the filter histories
+    step();
+
+    Result result{stage, streamRate, 0, 0, 0, 0};
+    uint64_t heapBefore = heapAllocations.load();
+    uint64_t poolBefore = pool ? pool->getAllocations() : 0;
+    auto begin = std::chrono::steady_clock::now();
+    do
+    {
+        result.samples += step();
+        result.blocks++;
+        result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    } while (result.elapsed < config.seconds);
+    result.allocations = heapAllocations.load() - heapBefore + (pool ? pool->getAllocations() - poolBefore : 0);
+    return result;
+}
+
+// The signal is handed to the pipelines without copies, and stays owned by the benchmark
+static void keepInput(uint8_t *, size_t, void *)
+{
+}
+
+/**
+ * @brief Feed a whole pipeline as fast as it takes the blocks, until all the expected audio has come out
+ */
+template <typename Demodulator, typename Callback>
+static Result measurePipeline(const Config &config, const std::string &stage, const std::vector<uint8_t> &iq,
+                              size_t expectedAudio, const std::function<Demodulator *(Callback)> &create)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t audio = 0;
+    auto onAudio = [&](size_t count) {
+        std::lock_guard<std::mutex> lock(mtx);
+        audio += count;
+        cv.notify_all();
+    };
+
+    // The construction, which designs the filters and starts the threads, is not measured
+    Demodulator *demodulator = create(onAudio);
+    uint64_t heapBefore = heapAllocations.load();
+    auto begin = std::chrono::steady_clock::now();
+    size_t blocks = 0;
+    for (size_t i = 0; i < iq.size(); i += 2 * config.block, blocks++)
+    {
+        size_t bytes = std::min(2 * config.block, iq.size() - i);
+        demodulator->demodulate(const_cast<uint8_t *>(iq.data()) + i, bytes, &keepInput, nullptr);
+    }
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait_for(lock, std::chrono::seconds(60), [&] { return audio >= expectedAudio; });
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t allocations = heapAllocations.load() - heapBefore;
+    delete demodulator;
+
+    return Result{stage, (double)config.sampleRate, iq.size() / 2, blocks, allocations, elapsed};
+}
+
+template <typename R>
+static void runStages(const Config &config, std::vector<Result> &results)
+{
+    typedef BasicComplex<R> Sample;
+    const int fs = config.sampleRate;
+    const int fa = config.audioSampleRate;
+    const int ir = BasicFmDemodulator<R>::chooseIntermediateRate(fs, fa);
+    const size_t block = config.block;
+
+    // One second of signal, and the input of every stage computed once through the chain
+    std::vector<uint8_t> iq = generateFm(fs, fs, 0);
+    std::vector<uint8_t> iqOffset = generateFm(fs, fs, fs / 8);
+    size_t sdrBlocks = iq.size() / 2 / block;
+    auto sdrBlock = [&](size_t n, const std::vector<uint8_t> &source) { return source.data() + 2 * (n % sdrBlocks) * block; };
+
+    IqConverter converter;
+    DataBuffer<Sample> converted(iq.size() / 2);
+    converter.convert(iq.data(), converted.size(), converted.get());
+    RationalResampler<Sample> iqResampler(fs, ir, 100000, 40000);
+    DataBuffer<Sample> intermediate = iqResampler.resample(converted);
+    QuadratureDiscriminator<R> discriminator;
+    DataBuffer<R> mpx(intermediate.size());
+    discriminator.demodulate(intermediate.get(), intermediate.size(), mpx.get());
+
+    size_t irBlock = std::max<size_t>(1, block * (size_t)ir / fs);
+    size_t irBlocks = std::max<size_t>(1, mpx.size() / irBlock);
+
+    {
+        BufferPool pool;
+        size_t n = 0;
+        results.push_back(measure(config, "convert", fs, [&] {
+            DataBuffer<Sample> out(block, &pool);
+            converter.convert(sdrBlock(n++, iq), block, out.get());
+            return block;
+        }, &pool));
+    }
+    {
+        BufferPool pool;
+        Nco<R> nco(-fs / 8, fs);
+        size_t n = 0;
+        results.push_back(measure(config, "convert_nco", fs, [&] {
+            DataBuffer<Sample> out(block, &pool);
+            converter.convert(sdrBlock(n++, iqOffset), block, out.get(), nco);
+            return block;
+        }, &pool));
+    }
+    {
+        // The FFT low-pass filter at the SDR rate, before any decimation
+        LowPass<Sample> lowPass(100000, 4096, fs, RationalResampler<Sample>::tapsPerPhaseFor(fs, 40000));
+        DataBuffer<Sample> data(block);
+        size_t n = 0;
+        results.push_back(measure(config, "iq_lowpass_fft", fs, [&] {
+            memcpy(data.get(), converted.get() + (n++ % sdrBlocks) * block, sizeof(Sample) * block);
+            lowPass.filter(data);
+            return block;
+        }));
+    }
+    {
+        BufferPool pool;
+        RationalResampler<Sample> resampler(fs, ir, 100000, 40000);
+        size_t n = 0;
+        results.push_back(measure(config, "iq_resampler", fs, [&] {
+            DataBuffer<Sample> out(resampler.outputSize(block), &pool);
+            resampler.resample(converted.get() + (n++ % sdrBlocks) * block, block, out.get());
+            return block;
+        }, &pool));
+    }
+    {
+        BufferPool pool;
+        QuadratureDiscriminator<R> stage;
+        size_t n = 0;
+        results.push_back(measure(config, "discriminator", ir, [&] {
+            DataBuffer<R> out(irBlock, &pool);
+            stage.demodulate(intermediate.get() + (n++ % irBlocks) * irBlock, irBlock, out.get());
+            return irBlock;
+        }, &pool));
+    }
+    {
+        LowPass<R> lowPass(20000, 4096, ir, RationalResampler<R>::tapsPerPhaseFor(ir, 4000));
+        DataBuffer<R> data(irBlock);
+        size_t n = 0;
+        results.push_back(measure(config, "audio_lowpass_fft", ir, [&] {
+            memcpy(data.get(), mpx.get() + (n++ % irBlocks) * irBlock, sizeof(R) * irBlock);
+            lowPass.filter(data);
+            return irBlock;
+        }));
+    }
+    {
+        BufferPool pool;
+        RationalResampler<R> resampler(ir, fa, 20000, 4000);
+        size_t n = 0;
+        results.push_back(measure(config, "audio_resampler", ir, [&] {
+            DataBuffer<R> out(resampler.outputSize(irBlock), &pool);
+            resampler.resample(mpx.get() + (n++ % irBlocks) * irBlock, irBlock, out.get());
+            return irBlock;
+        }, &pool));
+    }
+    {
+        BufferPool pool;
+        StereoDecoder<R> decoder(ir, fa);
+        size_t n = 0;
+        results.push_back(measure(config, "stereo_decoder", ir, [&] {
+            DataBuffer<R> out(2 * decoder.outputSize(irBlock), &pool);
+            decoder.decode(mpx.get() + (n++ % irBlocks) * irBlock, irBlock, out.get());
+            return irBlock;
+        }, &pool));
+    }
+    {
+        BufferPool pool;
+        int channels = BasicFmMultiDemodulator<R>::chooseChannels(fs);
+        PolyphaseChannelizer<R> channelizer(channels, channels / 2, fs / channels,
+                                            std::max(40000, fs / channels - 200000), fs);
+        std::vector<Sample *> outputs(channels);
+        size_t n = 0;
+        results.push_back(measure(config, "channelizer", fs, [&] {
+            DataBuffer<Sample> out(channels * (channelizer.outputSize(block) + 1), &pool);
+            size_t size = channelizer.outputSize(block);
+            for (int k = 0; k < channels; k++)
+            {
+                outputs[k] = out.get() + k * size;
+            }
+            channelizer.channelize(converted.get() + (n++ % sdrBlocks) * block, block, outputs.data());
+            return block;
+        }, &pool));
+    }
+
+    // Whole pipelines, on as much signal as the stages have been measured on
+    size_t pipelineSamples = std::max<size_t>(block, (size_t)(config.seconds * fs));
+    std::vector<uint8_t> signal = generateFm(fs, pipelineSamples, 0);
+    RationalResampler<Sample> iqRatio(fs, ir, 100000, 40000);
+    RationalResampler<R> audioRatio(ir, fa, 20000, 4000);
+    size_t expectedAudio = audioRatio.outputIndexAt(iqRatio.outputIndexAt(pipelineSamples));
+
+    FmDemodulatorOptions options;
+    options.overflowPolicy = OverflowPolicy::Block;
+    typedef std::function<void(size_t)> AudioCounter;
+    results.push_back(measurePipeline<BasicFmDemodulator<R>, AudioCounter>(
+        config, "pipeline", signal, expectedAudio, [&](AudioCounter counter) {
+            return new BasicFmDemodulator<R>([counter](const DataBuffer<int16_t> &audio) { counter(audio.size()); },
+                                             fs, fa, 1.0f, options);
+        }));
+
+    // The same pipeline with its stages run as tasks of the process-wide scheduler
+    FmDemodulatorOptions shared = options;
+    shared.scheduler = &TaskScheduler::shared();
+    results.push_back(measurePipeline<BasicFmDemodulator<R>, AudioCounter>(
+        config, "pipeline_shared", signal, expectedAudio, [&](AudioCounter counter) {
+            return new BasicFmDemodulator<R>([counter](const DataBuffer<int16_t> &audio) { counter(audio.size()); },
+                                             fs, fa, 1.0f, shared);
+        }));
+
+    FmDemodulatorOptions stereo = options;
+    stereo.stereo = true;
+    results.push_back(measurePipeline<BasicFmDemodulator<R>, AudioCounter>(
+        config, "pipeline_stereo", signal, 2 * expectedAudio, [&](AudioCounter counter) {
+            return new BasicFmDemodulator<R>([counter](const DataBuffer<int16_t> &audio) { counter(audio.size()); },
+                                             fs, fa, 1.0f, stereo);
+        }));
+
+    {
+        BasicFmSyncDemodulator<R> sync([](const DataBuffer<int16_t> &) {}, fs, fa);
+        size_t n = 0;
+        results.push_back(measure(config, "pipeline_sync", fs, [&] {
+            sync.demodulate(sdrBlock(n++, iq), 2 * block);
+            return block;
+        }));
+    }
+    {
+        BasicFmFileDemodulator<R> offline(fs, fa);
+        uint64_t heapBefore = heapAllocations.load();
+        auto begin = std::chrono::steady_clock::now();
+        size_t blocks = 0;
+        offline.demodulate(signal.data(), signal.size(), [&](const DataBuffer<int16_t> &) { blocks++; });
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        results.push_back(Result{"offline", (double)fs, pipelineSamples, blocks, heapAllocations.load() - heapBefore, elapsed});
+    }
+}
+
+static void report(const Config &config, const std::vector<Result> &results)
+{
+    const char *precision = config.single ? "float" : "double";
+    if (config.json)
+    {
+        printf("{\"sampleRate\":%d,\"audioSampleRate\":%d,\"block\":%zu,\"precision\":\"%s\",\"kernel\":\"%s\",\"stages\":[",
+               config.sampleRate, config.audioSampleRate, config.block, precision, IqConverter::kernelName());
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &r = results[i];
+            printf("%s\n{\"stage\":\"%s\",\"samples\":%llu,\"seconds\":%.6f,\"samplesPerSecond\":%.1f,"
+                   "\"nsPerSample\":%.4f,\"realtime\":%.2f,\"allocationsPerBlock\":%.3f}",
+                   i ? "," : "", r.stage.c_str(), (unsigned long long)r.samples, r.elapsed, r.samples / r.elapsed,
+                   1e9 * r.elapsed / r.samples, r.samples / r.elapsed / r.streamRate,
+                   r.blocks ? (double)r.allocations / r.blocks : 0.0);
+        }
+        printf("\n]}\n");
+        return;
+    }
+
+    printf("SDR %d S/s, audio %d S/s, blocks of %zu IQ samples, %s, %s conversion\n\n", config.sampleRate,
+           config.audioSampleRate, config.block, precision, IqConverter::kernelName());
+    printf("%-20s %12s %12s %12s %14s\n", "stage", "MS/s", "ns/sample", "x realtime", "allocs/block");
+    for (const Result &r : results)
+    {
+        printf("%-20s %12.2f %12.3f %12.1f %14.3f\n", r.stage.c_str(), r.samples / r.elapsed / 1e6,
+               1e9 * r.elapsed / r.samples, r.samples / r.elapsed / r.streamRate,
+               r.blocks ? (double)r.allocations / r.blocks : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rate" && hasValue)
+        {
+            config.sampleRate = atoi(argv[++i]);
+        }
+        else if (arg == "--audio-rate" && hasValue)
+        {
+            config.audioSampleRate = atoi(argv[++i]);
+        }
+        else if (arg == "--block" && hasValue)
+        {
+            config.block = (size_t)atol(argv[++i]);
+        }
+        else if (arg == "--time" && hasValue)
+        {
+            config.seconds = atof(argv[++i]);
+        }
+        else if (arg == "--float")
+        {
+            config.single = true;
+        }
+        else if (arg == "--json")
+        {
+            config.json = true;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--rate <SDR rate>] [--audio-rate <rate>] [--block <IQ samples>] "
+                            "[--time <seconds per stage>] [--float] [--json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.sampleRate <= 0 || config.audioSampleRate <= 0 || config.block == 0 ||
+        config.block > (size_t)config.sampleRate)
+    {
+        fprintf(stderr, "Invalid settings, the block must be at most one second of samples\n");
+        return 1;
+    }
+
+    std::vector<Result> results;
+    if (config.single)
+    {
+        runStages<float>(config, results);
+    }
+    else
+    {
+        runStages<double>(config, results);
+    }
+    report(config, results);
+    return 0;
+}
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "TaskScheduler.h"
+
+// Set to 1 when the compiler supports C++20 coroutines, which enables `readAsync`
+#ifndef FMDEMOD_COROUTINES
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define FMDEMOD_COROUTINES 1
+#endif
+#endif
+#endif
+#ifndef FMDEMOD_COROUTINES
+#define FMDEMOD_COROUTINES 0
+#endif
+
+#if FMDEMOD_COROUTINES
+#include <coroutine>
+#endif
+
+/**
+ * @brief Lock-free ring of audio samples between the demodulator and a consumer pulling them.
+ * The demodulator writes the audio of every block straight into the ring and never waits: a block
+ * that does not fit is dropped and counted as an overrun. The consumer reads as many samples as it
+ * wants at a time, waiting for them with `read`, or with `co_await readAsync(...)` in C++20.
+ * Stereo samples are interleaved and written by whole blocks, so reading an even number of
+ * samples keeps the channels aligned. One thread writes and one thread reads at a time.
+ * The ring must outlive its reader: close it and wait for the reader to return before destroying it
+ */
+class AudioRing
+{
+public:
+    typedef void (*ResumeFunction)(void *);
+
+    AudioRing(const AudioRing &) = delete;
+
+    /**
+     * @brief Construct a new AudioRing object
+     *
+     * @param capacity Number of samples, rounded up to a power of two
+     * @param scheduler Scheduler resuming the coroutines waiting in `readAsync`, or `nullptr` for
+     * `TaskScheduler::shared()`. They are never resumed by the writer, which must not run the reader
+     */
+    AudioRing(size_t capacity, TaskScheduler *scheduler = nullptr)
+        : samples(roundUpPowerOfTwo(capacity)), mask(samples.size() - 1), scheduler(scheduler)
+    {
+    }
+
+    ~AudioRing()
+    {
+        // A reader still waiting would be resumed on a destroyed ring
+        assert(!(waiterState.load() & WAITER_ARMED) && !readerParked.load());
+    }
+
+    size_t capacity() const
+    {
+        return samples.size();
+    }
+
+    /**
+     * @brief Number of samples that can be read
+     */
+    size_t available() const
+    {
+        return (size_t)(tail.value.load(std::memory_order_acquire) - head.value.load(std::memory_order_acquire));
+    }
+
+    /**
+     * @brief Number of samples dropped because the ring was full
+     */
+    uint64_t getOverruns() const
+    {
+        return overruns.load(std::memory_order_relaxed);
+    }
+
+    bool isClosed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Get the free space for `count` samples, in two parts when it wraps around the end of
+     * the ring, to be filled and then published with `endWrite`. Writer only
+     *
+     * @param first Receives the first part
+     * @param firstSize Receives the size of the first part, at most `count`
+     * @param second Receives the second part, for the remaining `count - firstSize` samples
+     * @return false if fewer than `count` samples are free: the samples are counted as an overrun
+     */
+    bool beginWrite(size_t count, int16_t *&first, size_t &firstSize, int16_t *&second)
+    {
+        uint64_t t = tail.value.load(std::memory_order_relaxed);
+        if (count > samples.size() - (size_t)(t - head.value.load(std::memory_order_acquire)))
+        {
+            overruns.fetch_add(count, std::memory_order_relaxed);
+            return false;
+        }
+        size_t offset = (size_t)(t & mask);
+        first = samples.data() + offset;
+        firstSize = std::min(count, samples.size() - offset);
+        second = samples.data();
+        return true;
+    }
+
+    /**
+     * @brief Publish the samples written after `beginWrite`, and wake up the reader waiting for them. Writer only
+     */
+    void endWrite(size_t count)
+    {
+        tail.value.store(tail.value.load(std::memory_order_relaxed) + count, std::memory_order_seq_cst);
+
+        if (readerParked.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cv.notify_all();
+        }
+
+        resumeWaiter(false);
+    }
+
+    /**
+     * @brief Write all the samples, or none if they do not fit. Writer only
+     *
+     * @return false if the samples have been dropped
+     */
+    bool write(const int16_t *data, size_t count)
+    {
+        int16_t *first, *second;
+        size_t firstSize;
+        if (!beginWrite(count, first, firstSize, second))
+        {
+            return false;
+        }
+        memcpy(first, data, sizeof(int16_t) * firstSize);
+        memcpy(second, data + firstSize, sizeof(int16_t) * (count - firstSize));
+        endWrite(count);
+        return true;
+    }
+
+    /**
+     * @brief Read the samples available, up to `count`, without waiting. Reader only
+     *
+     * @return The number of samples read
+     */
+    size_t tryRead(int16_t *out, size_t count)
+    {
+        uint64_t h = head.value.load(std::memory_order_relaxed);
+        size_t n = std::min(count, (size_t)(tail.value.load(std::memory_order_acquire) - h));
+        size_t offset = (size_t)(h & mask);
+        size_t firstSize = std::min(n, samples.size() - offset);
+        memcpy(out, samples.data() + offset, sizeof(int16_t) * firstSize);
+        memcpy(out + firstSize, samples.data(), sizeof(int16_t) * (n - firstSize));
+        head.value.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief Read `count` samples, waiting for them. Reader only
+     *
+     * @return The number of samples read, fewer than `count` only if the ring has been closed
+     */
+    size_t read(int16_t *out, size_t count)
+    {
+        size_t done = tryRead(out, count);
+        while (done < count)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                // Announce the parking before checking again: the writer either sees the flag after
+                // publishing its samples, or the samples are seen by this check
+                readerParked.store(true, std::memory_order_seq_cst);
+                cv.wait(lock, [&]()
+                        { return isClosed() || available() > 0; });
+                readerParked.store(false, std::memory_order_relaxed);
+            }
+            size_t n = tryRead(out + done, count - done);
+            if (n == 0 && isClosed())
+            {
+                break;
+            }
+            done += n;
+        }
+        return done;
+    }
+
+    /**
+     * @brief Suspend a reader until `count` samples are available, used by `readAsync`. Reader only
+     *
+     * @param handle The suspended reader
+     * @param resume Called with `handle` to resume the reader
+     * @param count The number of samples to wait for, at most the capacity
+     * @return false if the samples are already available, the reader must not be suspended
+     */
+    bool suspendReader(void *handle, ResumeFunction resume, size_t count)
+    {
+        assert(count <= samples.size());
+        waiterHandle = handle;
+        waiterResume = resume;
+        waiterCount.store(count, std::memory_order_relaxed);
+        // Every suspension has its own ticket: once the writer has taken it, the reader can be
+        // resumed and suspended again before this function returns
+        uint64_t armed = ((waiterState.load(std::memory_order_relaxed) >> 1) + 1) << 1 | WAITER_ARMED;
+        waiterState.store(armed, std::memory_order_seq_cst);
+
+        // The writer may have published the samples before seeing the waiter, in which case the
+        // reader takes its suspension back, unless the writer already took it. Either way the state
+        // is not touched again
+        if (available() >= count || isClosed())
+        {
+            return !waiterState.compare_exchange_strong(armed, armed & ~WAITER_ARMED, std::memory_order_seq_cst);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Release the reader: the waiting calls return with the samples available
+     */
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed.store(true, std::memory_order_seq_cst);
+            cv.notify_all();
+        }
+        resumeWaiter(true);
+    }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr uint64_t WAITER_ARMED = 1;
+
+    struct alignas(CACHE_LINE) Counter
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    // Index of the next sample to read, written by the reader
+    Counter head;
+    // Index of the next sample to write, written by the writer
+    Counter tail;
+    std::vector<int16_t> samples;
+    size_t mask;
+    TaskScheduler *scheduler;
+    std::atomic<uint64_t> overruns{0};
+
+    std::atomic<bool> readerParked{false}, closed{false};
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    // Ticket of the last suspension of the reader in `readAsync`, shifted left, and `WAITER_ARMED`
+    // while it waits. Clearing the flag takes the suspension
+    std::atomic<uint64_t> waiterState{0};
+    // Reader suspended, and the number of samples it waits for, written before the flag is set
+    void *waiterHandle = nullptr;
+    ResumeFunction waiterResume = nullptr;
+    std::atomic<size_t> waiterCount{0};
+
+    /**
+     * @brief Take the suspension of the reader, if it waits for samples now available or `force`,
+     * and resume it on the scheduler
+     */
+    void resumeWaiter(bool force)
+    {
+        uint64_t state = waiterState.load(std::memory_order_seq_cst);
+        while (state & WAITER_ARMED)
+        {
+            // Read after the flag, the count is the one of this suspension as long as the flag can be cleared
+            if (!force && available() < waiterCount.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            if (waiterState.compare_exchange_weak(state, state & ~WAITER_ARMED, std::memory_order_seq_cst))
+            {
+                // The reader can not suspend again before it is resumed
+                void *handle = waiterHandle;
+                ResumeFunction resume = waiterResume;
+                (scheduler != nullptr ? *scheduler : TaskScheduler::shared()).submit(resume, handle);
+                return;
+            }
+        }
+    }
+
+    static size_t roundUpPowerOfTwo(size_t n)
+    {
+        size_t size = 1;
+        while (size < n)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+};
+
+#if FMDEMOD_COROUTINES
+
+/**
+ * @brief Awaitable reading samples from an `AudioRing`, see `readAsync`
+ */
+class AudioRingRead
+{
+public:
+    AudioRingRead(AudioRing &ring, int16_t *out, size_t count) : ring(ring), out(out), count(count)
+    {
+    }
+
+    bool await_ready() const
+    {
+        return ring.available() >= count || ring.isClosed();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        return ring.suspendReader(handle.address(), &AudioRingRead::resume, count);
+    }
+
+    size_t await_resume()
+    {
+        return ring.tryRead(out, count);
+    }
+
+private:
+    AudioRing &ring;
+    int16_t *out;
+    size_t count;
+
+    static void resume(void *handle)
+    {
+        std::coroutine_handle<>::from_address(handle).resume();
+    }
+};
+
+/**
+ * @brief Read `count` samples from the ring in a coroutine: `size_t n = co_await readAsync(ring, out, count);`
+ * The coroutine is suspended until the samples are available, and resumed by the scheduler of the ring
+ *
+ * @param count The number of samples, at most the capacity of the ring
+ * @return The awaitable, giving the number of samples read, fewer than `count` only if the ring has been closed
+ */
+inline AudioRingRead readAsync(AudioRing &ring, int16_t *out, size_t count)
+{
+    return AudioRingRead(ring, out, count);
+}
+
+#endif
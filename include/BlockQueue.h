@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief FIFO queue of blocks stored by value in a ring buffer.
+ * The ring doubles its capacity when it is full, and never shrinks, so once the queue has reached
+ * its working depth pushing and popping do not allocate. It is not thread safe
+ * @tparam T The block type, it must be move constructible
+ */
+template <typename T>
+class BlockQueue
+{
+public:
+    BlockQueue(size_t initialCapacity = 8)
+        : slots(std::max<size_t>(initialCapacity, 1)), head(0), count(0)
+    {
+    }
+
+    void push(T &&item)
+    {
+        if (count == slots.size())
+        {
+            grow();
+        }
+        slots[(head + count) % slots.size()].emplace(std::move(item));
+        count++;
+    }
+
+    /**
+     * @brief Remove the oldest block. The queue must not be empty
+     */
+    T pop()
+    {
+        std::optional<T> &slot = slots[head];
+        T item(std::move(*slot));
+        slot.reset();
+        head = (head + 1) % slots.size();
+        count--;
+        return item;
+    }
+
+    /**
+     * @brief The oldest block. The queue must not be empty
+     */
+    T &front()
+    {
+        return *slots[head];
+    }
+
+    void clear()
+    {
+        while (count > 0)
+        {
+            pop();
+        }
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+private:
+    std::vector<std::optional<T>> slots;
+    size_t head, count;
+
+    void grow()
+    {
+        std::vector<std::optional<T>> larger(slots.size() * 2);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::optional<T> &slot = slots[(head + i) % slots.size()];
+            larger[i].emplace(std::move(*slot));
+            slot.reset();
+        }
+        slots.swap(larger);
+        head = 0;
+    }
+};
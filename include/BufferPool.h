@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+
+/**
+ * @brief Thread-safe pool of SIMD-aligned memory blocks.
+ * Blocks are grouped in power-of-two size classes and the released ones are kept in a free list
+ * per class, linked through the blocks themselves, so a stream of similarly sized buffers reaches
+ * a steady state where no heap allocation happens. A block can be released by a different thread
+ * than the one that acquired it. The pool must outlive the blocks it hands out
+ */
+class BufferPool
+{
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    BufferPool(const BufferPool &) = delete;
+
+    /**
+     * @brief Construct a new BufferPool object
+     *
+     * @param maxCachedPerClass Number of released blocks kept for every size class, the others are freed
+     */
+    BufferPool(size_t maxCachedPerClass = 32) : maxCachedPerClass(maxCachedPerClass)
+    {
+        for (size_t i = 0; i < SIZE_CLASSES; i++)
+        {
+            freeLists[i] = nullptr;
+            cached[i] = 0;
+        }
+    }
+
+    ~BufferPool()
+    {
+        for (size_t i = 0; i < SIZE_CLASSES; i++)
+        {
+            while (freeLists[i] != nullptr)
+            {
+                FreeBlock *block = freeLists[i];
+                freeLists[i] = block->next;
+                free(block);
+            }
+        }
+    }
+
+    /**
+     * @brief Get a block of at least `bytes` bytes
+     *
+     * @param bytes The requested size
+     * @param capacity Set to the actual size of the block, to be passed back to `release`
+     * @return The block, aligned to `ALIGNMENT` bytes
+     */
+    void *acquire(size_t bytes, size_t &capacity)
+    {
+        size_t sizeClass = sizeClassOf(bytes);
+        capacity = (size_t)1 << sizeClass;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            FreeBlock *block = freeLists[sizeClass];
+            if (block != nullptr)
+            {
+                freeLists[sizeClass] = block->next;
+                cached[sizeClass]--;
+                return block;
+            }
+        }
+
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        return aligned_alloc(ALIGNMENT, capacity);
+    }
+
+    /**
+     * @brief Give a block back to the pool
+     *
+     * @param data The block
+     * @param capacity The capacity returned by `acquire`
+     */
+    void release(void *data, size_t capacity)
+    {
+        if (data == nullptr)
+        {
+            return;
+        }
+
+        size_t sizeClass = sizeClassOf(capacity);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (cached[sizeClass] < maxCachedPerClass)
+            {
+                FreeBlock *block = reinterpret_cast<FreeBlock *>(data);
+                block->next = freeLists[sizeClass];
+                freeLists[sizeClass] = block;
+                cached[sizeClass]++;
+                return;
+            }
+        }
+
+        free(data);
+    }
+
+    /**
+     * @return The number of heap allocations performed by the pool so far
+     */
+    uint64_t getAllocations() const
+    {
+        return allocations.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t SIZE_CLASSES = 48;
+    // Smallest block, one cache line
+    static constexpr size_t MIN_SIZE_CLASS = 6;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    size_t maxCachedPerClass;
+    std::mutex mtx;
+    FreeBlock *freeLists[SIZE_CLASSES];
+    size_t cached[SIZE_CLASSES];
+    std::atomic<uint64_t> allocations{0};
+
+    static size_t sizeClassOf(size_t bytes)
+    {
+        size_t sizeClass = MIN_SIZE_CLASS;
+        while (((size_t)1 << sizeClass) < bytes)
+        {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+};
@@ -1,101 +1,127 @@
 #pragma once
 
 #include <cmath>
+#include <type_traits>
 #include "Math.h"
 
-struct Complex {
-    double re;
-    double im;
+/**
+ * @brief Complex sample
+ * @tparam R The real type of the two components (`double` or `float`)
+ */
+template<typename R>
+struct BasicComplex {
+    R re;
+    R im;
 
-    Complex& operator*=(double rhs) {
+    BasicComplex& operator*=(R rhs) {
         this->re *= rhs;
         this->im *= rhs;
         return *this;
     }
 
-    Complex operator*(double rhs) const {
-        return Complex{
+    BasicComplex operator*(R rhs) const {
+        return BasicComplex{
             this->re * rhs,
             this->im * rhs};
     }
 
-    Complex& operator/=(double rhs) {
+    BasicComplex& operator/=(R rhs) {
         this->re /= rhs;
         this->im /= rhs;
         return *this;
     }
 
-    Complex operator/(double rhs) const {
-        return Complex{
+    BasicComplex operator/(R rhs) const {
+        return BasicComplex{
             this->re / rhs,
             this->im / rhs};
     }
 
-    Complex& operator*=(const Complex& rhs) {
-        double r = this->re * rhs.re - this->im * rhs.im;
-        double i = this->re * rhs.im + this->im * rhs.re;
+    BasicComplex& operator*=(const BasicComplex& rhs) {
+        R r = this->re * rhs.re - this->im * rhs.im;
+        R i = this->re * rhs.im + this->im * rhs.re;
         this->re = r;
         this->im = i;
         return *this;
     }
 
-    Complex operator*(const Complex& rhs) const {
-        return Complex{
+    BasicComplex operator*(const BasicComplex& rhs) const {
+        return BasicComplex{
             this->re * rhs.re - this->im * rhs.im,
             this->re * rhs.im + this->im * rhs.re};
     }
 
-    Complex& operator/=(const Complex& rhs) {
-        double denom = sqr(rhs.re) + sqr(rhs.im);
-        double r = (this->re * rhs.re + this->im * rhs.im) / denom;
-        double i = (this->im * rhs.re - this->re * rhs.im) / denom;
+    BasicComplex& operator/=(const BasicComplex& rhs) {
+        R denom = sqr(rhs.re) + sqr(rhs.im);
+        R r = (this->re * rhs.re + this->im * rhs.im) / denom;
+        R i = (this->im * rhs.re - this->re * rhs.im) / denom;
         this->re = r;
         this->im = i;
         return *this;
     }
 
-    Complex operator/(const Complex& rhs) const {
-        double den = sqr(rhs.re) + sqr(rhs.im);
-        return Complex{
+    BasicComplex operator/(const BasicComplex& rhs) const {
+        R den = sqr(rhs.re) + sqr(rhs.im);
+        return BasicComplex{
             (this->re * rhs.re + this->im * rhs.im) / den,
             (this->im * rhs.re - this->re * rhs.im) / den};
     };
 
-    Complex& operator+=(const Complex& rhs) {
+    BasicComplex& operator+=(const BasicComplex& rhs) {
         this->re += rhs.re;
         this->im += rhs.im;
         return *this;
     }
 
-    Complex operator+(const Complex& rhs) const {
-        return Complex{
+    BasicComplex operator+(const BasicComplex& rhs) const {
+        return BasicComplex{
             this->re + rhs.re,
             this->im + rhs.im};
     }
 
-    Complex& operator-=(const Complex& rhs) {
+    BasicComplex& operator-=(const BasicComplex& rhs) {
         this->re -= rhs.re;
         this->im -= rhs.im;
         return *this;
     }
 
-    Complex operator-(const Complex& rhs) const {
-        return Complex{
+    BasicComplex operator-(const BasicComplex& rhs) const {
+        return BasicComplex{
             this->re - rhs.re,
             this->im - rhs.im};
     }
 
-    Complex operator-() const {
-        return Complex{
+    BasicComplex operator-() const {
+        return BasicComplex{
             -this->re,
             -this->im};
     }
     
-    double magnitude() const {
+    R magnitude() const {
         return sqrt(this->magnitudeSquared());
     }
     
-    double magnitudeSquared() const {
+    R magnitudeSquared() const {
         return sqr(this->re) + sqr(this->im);
     }
-};
\ No newline at end of file
+};
+
+typedef BasicComplex<double> Complex;
+typedef BasicComplex<float> ComplexF;
+
+template<typename T> struct is_complex_type final : std::false_type {
+};
+
+template<typename R> struct is_complex_type<BasicComplex<R>> final : std::true_type {
+};
+
+/**
+ * @brief The real type of a sample type: the component type of complex samples, the type itself otherwise
+ */
+template<typename T> struct real_type {
+    typedef T type;
+};
+
+template<typename R> struct real_type<BasicComplex<R>> {
+    typedef R type;
+};
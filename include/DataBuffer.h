@@ -9,29 +9,84 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <type_traits>
+#include "BufferPool.h"
 
+/**
+ * @brief Fixed size array of samples, allocated on the heap, taken from a `BufferPool` or
+ * borrowed from its owner. A pooled buffer gives its memory back to the pool when it is destroyed,
+ * a borrowed one calls the release function of its owner. The copies are always allocated on
+ * the heap so they do not depend on the lifetime of the pool or of the owner
+ */
 template<typename T>
 class DataBuffer {
+	static_assert(std::is_trivially_copyable<T>::value, "DataBuffer holds trivially copyable samples");
+
 public:
+	typedef void (*ReleaseFunction)(T *data, size_t size, void *arg);
+
 	DataBuffer() = delete;
 	DataBuffer(size_t size) :
-			buffer(new T[size]), _size(size) {
+			buffer(new T[size]), _size(size), pool(nullptr), capacity(0), releaseFunction(nullptr), releaseArg(nullptr) {
 	}
-	DataBuffer(const T *data, size_t size) :
-			buffer(new T[size]), _size(size) {
+	/**
+	 * @param size Number of samples
+	 * @param pool Pool the memory is taken from, or `nullptr` to allocate it on the heap
+	 */
+	DataBuffer(size_t size, BufferPool *pool) :
+			buffer(nullptr), _size(size), pool(pool), capacity(0), releaseFunction(nullptr), releaseArg(nullptr) {
+		if (pool != nullptr) {
+			buffer = reinterpret_cast<T*>(pool->acquire(sizeof(T) * size, capacity));
+		} else {
+			buffer = new T[size];
+		}
+	}
+	DataBuffer(const T *data, size_t size, BufferPool *pool = nullptr) :
+			DataBuffer(size, pool) {
 		memcpy(buffer, data, sizeof(T) * _size);
 	}
+	/**
+	 * @brief Wrap memory owned by someone else, without copying it
+	 *
+	 * @param data The samples, which must stay valid until they are released
+	 * @param size Number of samples
+	 * @param release Called with `data`, `size` and `arg` when the buffer is destroyed
+	 * @param arg The argument passed to the release function
+	 */
+	DataBuffer(T *data, size_t size, ReleaseFunction release, void *arg) :
+			buffer(data), _size(size), pool(nullptr), capacity(0), releaseFunction(release), releaseArg(arg) {
+	}
 	DataBuffer(const DataBuffer<T> &rhs) :
-			buffer(new T[rhs._size]), _size(rhs._size) {
+			buffer(new T[rhs._size]), _size(rhs._size), pool(nullptr), capacity(0), releaseFunction(nullptr), releaseArg(nullptr) {
 		memcpy(buffer, rhs.buffer, sizeof(T) * _size);
 	}
 	DataBuffer(DataBuffer<T> &&rhs) :
-			buffer(rhs.buffer), _size(rhs._size) {
+			buffer(rhs.buffer), _size(rhs._size), pool(rhs.pool), capacity(rhs.capacity),
+			releaseFunction(rhs.releaseFunction), releaseArg(rhs.releaseArg) {
 		rhs.buffer = nullptr;
 		rhs._size = 0;
+		rhs.pool = nullptr;
+		rhs.releaseFunction = nullptr;
 	}
+	DataBuffer<T>& operator=(DataBuffer<T> &&rhs) {
+		if (this != &rhs) {
+			release();
+			buffer = rhs.buffer;
+			_size = rhs._size;
+			pool = rhs.pool;
+			capacity = rhs.capacity;
+			releaseFunction = rhs.releaseFunction;
+			releaseArg = rhs.releaseArg;
+			rhs.buffer = nullptr;
+			rhs._size = 0;
+			rhs.pool = nullptr;
+			rhs.releaseFunction = nullptr;
+		}
+		return *this;
+	}
+	DataBuffer<T>& operator=(const DataBuffer<T> &rhs) = delete;
 	~DataBuffer() {
-		delete[] buffer;
+		release();
 	}
 	T* get() {
 		return buffer;
@@ -42,6 +97,9 @@ public:
 	T& operator[](size_t index) {
 		return buffer[index];
 	}
+	const T& operator[](size_t index) const {
+		return buffer[index];
+	}
 	size_t size() const {
 		return _size;
 	}
@@ -49,4 +107,21 @@ public:
 private:
 	T *buffer;
 	size_t _size;
+	BufferPool *pool;
+	// Size in bytes of the pooled block
+	size_t capacity;
+	// Owner of a borrowed buffer
+	ReleaseFunction releaseFunction;
+	void *releaseArg;
+
+	void release() {
+		if (releaseFunction != nullptr) {
+			releaseFunction(buffer, _size, releaseArg);
+		} else if (pool != nullptr) {
+			pool->release(buffer, capacity);
+		} else {
+			delete[] buffer;
+		}
+		buffer = nullptr;
+	}
 };
@@ -2,33 +2,63 @@
 
 #include <pthread.h>
 #include <mutex>
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include <memory>
+#include <atomic>
 #include <condition_variable>
+#include <thread>
+#include "BlockQueue.h"
+#include "QueuePolicy.h"
+#include "ThreadConfig.h"
+#include "TaskScheduler.h"
 
 /**
  * @brief Thread pool for data processing
  *
  * @tparam T The data type
- * @tparam Size The number of threads to spawn
+ * @tparam Size The default number of threads to spawn
+ * @tparam QueueMaxSize The number of blocks the queue holds before the overflow policy applies
  */
 template <typename T, size_t Size = 1, size_t QueueMaxSize = 25>
 class DataProcessingThreadPool
 {
     typedef void(*ExecutorFunction)(T &, void*);
+    typedef void(*DiscontinuityFunction)(void*);
+    static_assert(QueueMaxSize > 0, "The queue must hold at least one block");
 
 public:
     /**
      * @brief Construct a new Data Processing Thread Pool object
      *
      * @param executor The executor function that will process the data
+     * @param argument The argument passed to the executor
+     * @param policy What to do with the new data when the queue is full
+     * @param discontinuity Called before the executor when blocks have been dropped or cleared
+     * since the previous block, so the stream state can be reset. Can be `nullptr`
+     * @param workers The number of threads to spawn. With more than one thread the blocks are
+     * processed concurrently and can complete out of order
+     * @param threadConfig Placement, scheduling and name of the threads
+     * @param scheduler Shared scheduler running the blocks as tasks instead of the threads of the
+     * pool, at most `workers` at a time. Can be `nullptr`
      */
-    DataProcessingThreadPool(ExecutorFunction executor, void* argument)
-        : executor(executor), executorArg(argument)
+    DataProcessingThreadPool(ExecutorFunction executor, void* argument,
+                             OverflowPolicy policy = OverflowPolicy::DropOldest,
+                             DiscontinuityFunction discontinuity = nullptr,
+                             size_t workers = Size,
+                             const ThreadConfig &threadConfig = ThreadConfig(),
+                             TaskScheduler *scheduler = nullptr)
+        : executor(executor), discontinuity(discontinuity), executorArg(argument), policy(policy),
+          workers(std::max<size_t>(workers, 1)), scheduler(scheduler)
     {
-        for (size_t i = 0; i < Size; i++)
+        if (scheduler != nullptr)
         {
-            pthread_create(&pool[i], NULL, &DataProcessingThreadPool<T, Size>::innerExecutor, this);
+            return;
+        }
+        pool.resize(this->workers);
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            threadConfigApplied &= threadConfig.start(pool[i], &DataProcessingThreadPool::innerExecutor, this, i, pool.size());
         }
     }
 
@@ -37,22 +67,28 @@ public:
         {
             std::unique_lock<std::mutex> lock(mtx);
             // Empty queue
-            while (dataQueue.size() > 0)
-            {
-                dataQueue.pop();
-            }
+            dataQueue.clear();
             // Notify the threads to stop
             running = false;
             lock.unlock();
-            // Awake all threads in the pool
+            // Awake all threads in the pool and the blocked producers
             cv.notify_all();
+            spaceCv.notify_all();
         }
 
         // Wait for all the threads to end their life
-        for (size_t i = 0; i < Size; i++)
+        for (size_t i = 0; i < pool.size(); i++)
         {
             pthread_join(pool[i], NULL);
         }
+
+        // Or for the submitted tasks to see that the pool is stopped
+        if (scheduler != nullptr)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            wait(lock, [&]()
+                 { return activeTasks == 0; });
+        }
     }
 
     /**
@@ -62,11 +98,7 @@ public:
      */
     void process(const T &data)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        dataQueue.emplace(std::make_unique<T>(data));
-        checkQueueLimits();
-        lock.unlock();
-        cv.notify_one();
+        enqueue(T(data));
     }
 
     /**
@@ -76,25 +108,19 @@ public:
      */
     void process(T &&data)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        dataQueue.emplace(std::make_unique<T>(std::move(data)));
-        checkQueueLimits();
-        lock.unlock();
-        cv.notify_one();
+        enqueue(std::move(data));
     }
 
     /**
-     * @brief This function will add directly the data to the queue for being processed by the pool
+     * @brief This function will move the data into the queue for being processed by the pool,
+     * and delete it
      *
      * @param data The data to process
      */
     void process(T *data)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        dataQueue.emplace(std::unique_ptr<T>(data));
-        checkQueueLimits();
-        lock.unlock();
-        cv.notify_one();
+        std::unique_ptr<T> owned(data);
+        enqueue(std::move(*owned));
     }
 
     /**
@@ -103,46 +129,250 @@ public:
     void clear()
     {
         std::unique_lock<std::mutex> lock(mtx);
-        while(!dataQueue.empty()) {
-            dataQueue.pop();
+        if (!dataQueue.empty())
+        {
+            dataQueue.clear();
+            pendingDiscontinuity = true;
         }
+        lock.unlock();
+        spaceCv.notify_all();
+    }
+
+    /**
+     * @return The overload counters of the queue
+     */
+    QueueStats getStats() const
+    {
+        QueueStats stats;
+        stats.dropped = dropped.load(std::memory_order_relaxed);
+        stats.blocked = blocked.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /**
+     * @return false if the thread configuration could not be fully applied
+     */
+    bool isThreadConfigApplied() const
+    {
+        return threadConfigApplied;
+    }
+
+    /**
+     * @return The number of blocks waiting in the queue
+     */
+    size_t getQueueSize() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return dataQueue.size();
     }
 
     static void *innerExecutor(void *arguments)
     {
-        DataProcessingThreadPool<T, Size> *_this = reinterpret_cast<DataProcessingThreadPool<T, Size> *>(arguments);
-        while (_this->running)
+        DataProcessingThreadPool *_this = reinterpret_cast<DataProcessingThreadPool *>(arguments);
+        while (true)
         {
             std::unique_lock<std::mutex> lock(_this->mtx);
             _this->cv.wait(lock, [&]()
-                           { return _this->dataQueue.size() > 0; });
-            std::unique_ptr<T> entry = std::unique_ptr<T>(std::move(_this->dataQueue.front()));
-            _this->dataQueue.pop();
+                           { return !_this->running || !_this->dataQueue.empty(); });
+            if (!_this->running)
+            {
+                break;
+            }
+            Entry entry = _this->dataQueue.pop();
             lock.unlock();
+            if (_this->policy == OverflowPolicy::Block)
+            {
+                _this->spaceCv.notify_one();
+            }
 
-            if (entry != nullptr)
+            if (entry.discontinuity && _this->discontinuity != nullptr)
             {
-                _this->executor(*entry, _this->executorArg);
+                _this->discontinuity(_this->executorArg);
             }
+            _this->executor(entry.data, _this->executorArg);
         }
 
         return NULL;
     }
 
+    /**
+     * @brief Process the queued blocks on a worker of the scheduler, a batch at a time so the
+     * other tasks of the scheduler get their turn
+     */
+    static void taskExecutor(void *arguments)
+    {
+        DataProcessingThreadPool *_this = reinterpret_cast<DataProcessingThreadPool *>(arguments);
+        std::unique_lock<std::mutex> lock(_this->mtx);
+        for (size_t i = 0; i < TASK_BATCH_SIZE; i++)
+        {
+            if (!_this->running || _this->dataQueue.empty())
+            {
+                // Notified with the lock held: the destructor waiting for the last task can proceed as soon as it is released
+                _this->activeTasks--;
+                _this->spaceCv.notify_all();
+                return;
+            }
+            if (_this->executing == _this->workers)
+            {
+                // Blocked producers are processing blocks in place of the task
+                break;
+            }
+            _this->runNext(lock);
+        }
+        lock.unlock();
+        _this->scheduler->submit(&DataProcessingThreadPool::taskExecutor, _this);
+    }
+
 private:
+    // Blocks processed by a task before it lets the other tasks of the scheduler run
+    static constexpr size_t TASK_BATCH_SIZE = 8;
+
+    struct Entry
+    {
+        T data;
+        // Blocks have been dropped between this block and the previous one
+        bool discontinuity;
+    };
+
     ExecutorFunction executor;
+    DiscontinuityFunction discontinuity;
     void* executorArg;
-    std::mutex mtx;
+    OverflowPolicy policy;
+    mutable std::mutex mtx;
     std::condition_variable cv;
-    std::queue<std::unique_ptr<T>> dataQueue;
-    pthread_t pool[Size];
+    // Signaled when a blocked producer may find room in the queue
+    std::condition_variable spaceCv;
+    // Blocks are queued by value, a pooled buffer only moves its pointer
+    BlockQueue<Entry> dataQueue;
+    // The next queued block follows dropped data
+    bool pendingDiscontinuity = false;
+    std::atomic<uint64_t> dropped{0}, blocked{0};
+    std::vector<pthread_t> pool;
+    size_t workers;
+    TaskScheduler *scheduler;
+    // Tasks submitted to the scheduler, at most `workers`
+    size_t activeTasks = 0;
+    // Blocks being processed by the tasks or by blocked producers, at most `workers`
+    size_t executing = 0;
     bool running = true;
-    
-    void checkQueueLimits()
+    bool threadConfigApplied = true;
+
+    void enqueue(T &&data)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!checkQueueLimits(lock))
+        {
+            return;
+        }
+        dataQueue.push(Entry{std::move(data), pendingDiscontinuity});
+        pendingDiscontinuity = false;
+
+        if (scheduler != nullptr)
+        {
+            // A task only ends when the queue is empty, so the queued blocks always have one
+            bool submit = activeTasks < workers;
+            activeTasks += submit;
+            lock.unlock();
+            if (submit)
+            {
+                scheduler->submit(&DataProcessingThreadPool::taskExecutor, this);
+            }
+            return;
+        }
+        lock.unlock();
+        cv.notify_one();
+    }
+
+    /**
+     * @brief Process the oldest queued block on the scheduler, with the lock held when called and when returning
+     */
+    void runNext(std::unique_lock<std::mutex> &lock)
+    {
+        executing++;
+        {
+            Entry entry = dataQueue.pop();
+            lock.unlock();
+            if (policy == OverflowPolicy::Block)
+            {
+                spaceCv.notify_one();
+            }
+
+            if (entry.discontinuity && discontinuity != nullptr)
+            {
+                discontinuity(executorArg);
+            }
+            executor(entry.data, executorArg);
+        }
+        lock.lock();
+        executing--;
+    }
+
+    /**
+     * @brief Wait on `spaceCv` until `done`, with the lock held. A worker of the scheduler can not
+     * sleep, the task it waits for could be queued behind it: it processes the queued blocks itself
+     * while the tasks leave it room, and yields otherwise
+     */
+    template <typename F>
+    void wait(std::unique_lock<std::mutex> &lock, F done)
     {
-        return;
-        while(dataQueue.size() > QueueMaxSize) {
-            dataQueue.pop();
+        if (scheduler == nullptr || !scheduler->isWorkerThread())
+        {
+            spaceCv.wait(lock, done);
+            return;
+        }
+        while (!done())
+        {
+            if (running && !dataQueue.empty() && executing < workers)
+            {
+                runNext(lock);
+                continue;
+            }
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+    /**
+     * @brief Make room for a new block according to the overflow policy
+     *
+     * @return false if the new block has to be dropped
+     */
+    bool checkQueueLimits(std::unique_lock<std::mutex> &lock)
+    {
+        if (dataQueue.size() < QueueMaxSize)
+        {
+            return true;
+        }
+
+        switch (policy)
+        {
+        case OverflowPolicy::Block:
+            blocked.fetch_add(1, std::memory_order_relaxed);
+            wait(lock, [&]()
+                 { return !running || dataQueue.size() < QueueMaxSize; });
+            return running;
+        case OverflowPolicy::DropOldest:
+            while (dataQueue.size() >= QueueMaxSize)
+            {
+                dataQueue.pop();
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            // The oldest remaining block no longer follows the one processed before it
+            if (!dataQueue.empty())
+            {
+                dataQueue.front().discontinuity = true;
+            }
+            else
+            {
+                pendingDiscontinuity = true;
+            }
+            return true;
+        case OverflowPolicy::DropNewest:
+        default:
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            pendingDiscontinuity = true;
+            return false;
         }
     }
 };
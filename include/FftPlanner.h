@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <fftw3.h>
+
+/**
+ * @brief Rigor used by FFTW when building a plan.
+ * Higher rigor plans take longer to create but run faster. The planning cost can be
+ * avoided on the following runs by saving and loading the FFTW wisdom
+ */
+enum class FftPlannerRigor : unsigned
+{
+    Estimate = FFTW_ESTIMATE,
+    Measure = FFTW_MEASURE,
+    Patient = FFTW_PATIENT
+};
+
+/**
+ * @brief The FFTW interface of a precision: `fftw_*` for `double`, `fftwf_*` for `float`
+ * @tparam R The real type
+ */
+template <typename R>
+struct Fftw;
+
+template <>
+struct Fftw<double>
+{
+    typedef fftw_complex complex;
+    typedef fftw_plan plan;
+
+    static double *allocReal(size_t n) { return fftw_alloc_real(n); }
+    static complex *allocComplex(size_t n) { return fftw_alloc_complex(n); }
+    static void free(void *p) { fftw_free(p); }
+    static plan planDft(int n, complex *in, complex *out, int sign, unsigned flags) { return fftw_plan_dft_1d(n, in, out, sign, flags); }
+    static plan planDftR2c(int n, double *in, complex *out, unsigned flags) { return fftw_plan_dft_r2c_1d(n, in, out, flags); }
+    static plan planDftC2r(int n, complex *in, double *out, unsigned flags) { return fftw_plan_dft_c2r_1d(n, in, out, flags); }
+    static void execute(const plan p) { fftw_execute(p); }
+    static void destroyPlan(plan p) { fftw_destroy_plan(p); }
+    static int importWisdom(const char *path) { return fftw_import_wisdom_from_filename(path); }
+    static int exportWisdom(const char *path) { return fftw_export_wisdom_to_filename(path); }
+    static void forgetWisdom() { fftw_forget_wisdom(); }
+};
+
+template <>
+struct Fftw<float>
+{
+    typedef fftwf_complex complex;
+    typedef fftwf_plan plan;
+
+    static float *allocReal(size_t n) { return fftwf_alloc_real(n); }
+    static complex *allocComplex(size_t n) { return fftwf_alloc_complex(n); }
+    static void free(void *p) { fftwf_free(p); }
+    static plan planDft(int n, complex *in, complex *out, int sign, unsigned flags) { return fftwf_plan_dft_1d(n, in, out, sign, flags); }
+    static plan planDftR2c(int n, float *in, complex *out, unsigned flags) { return fftwf_plan_dft_r2c_1d(n, in, out, flags); }
+    static plan planDftC2r(int n, complex *in, float *out, unsigned flags) { return fftwf_plan_dft_c2r_1d(n, in, out, flags); }
+    static void execute(const plan p) { fftwf_execute(p); }
+    static void destroyPlan(plan p) { fftwf_destroy_plan(p); }
+    static int importWisdom(const char *path) { return fftwf_import_wisdom_from_filename(path); }
+    static int exportWisdom(const char *path) { return fftwf_export_wisdom_to_filename(path); }
+    static void forgetWisdom() { fftwf_forget_wisdom(); }
+};
+
+/**
+ * @brief Process-wide helpers around the FFTW planner.
+ * Only the execution of a plan is thread safe in FFTW: creating and destroying plans and
+ * accessing the wisdom must hold the planner mutex, every other operation runs lock-free.
+ * In the demodulators, only the `PolyphaseChannelizer` of `FmMultiDemodulator` creates plans:
+ * the single station pipelines filter in the time domain with `RationalResampler`
+ */
+class FftPlanner
+{
+public:
+    FftPlanner() = delete;
+
+    /**
+     * @brief Import the FFTW wisdom from a file. Plans created afterwards with a matching
+     * size and rigor are obtained without measuring again. Every precision has its own wisdom
+     *
+     * @tparam R The precision of the wisdom
+     * @param path The wisdom file path
+     * @return true if the wisdom was loaded
+     */
+    template <typename R = double>
+    static bool loadWisdom(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        return Fftw<R>::importWisdom(path.c_str()) != 0;
+    }
+
+    /**
+     * @brief Export the wisdom accumulated by the planner so far to a file
+     *
+     * @tparam R The precision of the wisdom
+     * @param path The wisdom file path
+     * @return true if the wisdom was saved
+     */
+    template <typename R = double>
+    static bool saveWisdom(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        return Fftw<R>::exportWisdom(path.c_str()) != 0;
+    }
+
+    /**
+     * @brief Discard the wisdom accumulated by the planner
+     *
+     * @tparam R The precision of the wisdom
+     */
+    template <typename R = double>
+    static void forgetWisdom()
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        Fftw<R>::forgetWisdom();
+    }
+
+    /**
+     * @brief The process-wide planner mutex
+     */
+    static std::mutex &mutex()
+    {
+        static std::mutex plannerMtx;
+        return plannerMtx;
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+/**
+ * @brief FIR filter design helpers
+ */
+class FirDesign
+{
+public:
+    FirDesign() = delete;
+
+    /**
+     * @brief Design a linear-phase low-pass filter with the windowed-sinc method (Blackman window)
+     *
+     * @param taps Filter length
+     * @param cutoff Cut-off frequency (-6 dB point)
+     * @param sampleRate Sample rate the filter runs at
+     * @param gain Gain at DC
+     * @return The filter impulse response
+     */
+    static std::vector<double> lowPass(int taps, double cutoff, double sampleRate, double gain = 1.0)
+    {
+        std::vector<double> h(taps);
+        double fc = cutoff / sampleRate;
+        double center = (taps - 1) / 2.0;
+        double sum = 0;
+
+        for (int i = 0; i < taps; i++)
+        {
+            double x = i - center;
+            double sinc = x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+            h[i] = sinc * blackman(i, taps);
+            sum += h[i];
+        }
+
+        for (int i = 0; i < taps; i++)
+        {
+            h[i] *= gain / sum;
+        }
+
+        return h;
+    }
+
+private:
+    static double blackman(int i, int taps)
+    {
+        if (taps == 1)
+        {
+            return 1;
+        }
+        double x = 2 * M_PI * i / (taps - 1);
+        return 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+    }
+};
@@ -12,63 +12,394 @@
 #include <condition_variable>
 #include <chrono>
 #include <memory>
+#include <functional>
+#include <atomic>
 #include "Complex.h"
-#include "LowPass.h"
+#include "RationalResampler.h"
+#include "IqConverter.h"
+#include "Nco.h"
+#include "StereoDecoder.h"
+#include "QuadratureDiscriminator.h"
 #include "DataProcessingThreadPool.h"
+#include "SpscProcessingThread.h"
+#include "ReorderBuffer.h"
+#include "QueuePolicy.h"
+#include "ThreadConfig.h"
+#include "TaskScheduler.h"
+#include "FftPlanner.h"
+#include "AudioRing.h"
+#include "Telemetry.h"
 #include "DataBuffer.h"
-#include "DownsampledBufferAccessor.h"
+#include "BufferPool.h"
 #include "Math.h"
 
-class FmDemodulator
+/**
+ * @brief Optional settings of the demodulation pipeline
+ */
+struct FmDemodulatorOptions
 {
+    // Track and remove the DC offset of the IQ samples during their conversion
+    bool removeDcOffset = false;
+    // Scale applied to the IQ samples during their conversion
+    double iqScale = 1.0;
+    // Phase difference formula of the FM discriminator
+    DiscriminatorMode discriminator = DiscriminatorMode::CrossProduct;
+    // What the input queue does when the pipeline can not keep up with the SDR
+    OverflowPolicy overflowPolicy = OverflowPolicy::DropOldest;
+    // Number of threads running the IQ resampler, the heaviest stage at high sample rates
+    int filterWorkers = 1;
+    // Frequency of the station relative to the center of the capture, in Hz. Tuning the SDR off
+    // the station keeps its DC spike out of the demodulated channel
+    int frequencyOffset = 0;
+    // Decode FM stereo: the callback receives interleaved left and right samples, which are equal
+    // while the pilot is not received
+    bool stereo = false;
+    // Largest delay, in seconds, the pipeline should add to the audio, or 0 to favor the throughput.
+    // The blocks are split in slices of a quarter of the budget that go through the stages on their
+    // own, and the caller should push blocks of `inputBlockSize` bytes
+    double latencyBudget = 0;
+    // Placement, scheduling and name of the threads of each stage, the filter workers share the
+    // CPUs of their stage. FmMultiDemodulator runs its channelizer like the transform stage and
+    // its stations like the demod stage
+    ThreadConfig transformThread = ThreadConfig("fm-transform");
+    ThreadConfig filterThreads = ThreadConfig("fm-filter");
+    ThreadConfig demodThread = ThreadConfig("fm-demod");
+    // Scheduler running the stages as tasks instead of their own threads, such as `&TaskScheduler::shared()`,
+    // so many demodulators share a thread per core. The thread configurations are then not used, the
+    // scheduler has its own. It must outlive the demodulator
+    TaskScheduler *scheduler = nullptr;
+    // FFTW planning rigor of the filterbank of FmMultiDemodulator, the other demodulators use no FFT. Load the wisdom with
+    // `FftPlanner::loadWisdom` before constructing the demodulator to skip the measurements
+    FftPlannerRigor plannerRigor = FftPlannerRigor::Estimate;
+};
+
+/**
+ * @brief Settings of the pipeline that can be changed while it runs
+ */
+struct FmDemodulatorSettings
+{
+    // SDR sample rate
+    int sampleRate = 0;
+    // Output audio sample rate
+    int audioSampleRate = 0;
+    float digitalGain = 1.0f;
+    // Frequency of the station relative to the center of the capture, in Hz
+    int frequencyOffset = 0;
+    // Cut-off frequency of the IQ lowpass filter, in Hz
+    int iqCutoff = 100000;
+    // Cut-off frequency of the mono audio lowpass filter, in Hz, lowered if the audio sample rate
+    // is too low for it. The stereo decoder keeps its own
+    int audioCutoff = 20000;
+};
+
+/**
+ * @brief Overload counters of the pipeline queues
+ */
+struct FmDemodulatorQueueStats
+{
+    // Queue of the raw SDR blocks, where the overflow policy applies
+    QueueStats input;
+    // Queues between the stages, which block the previous stage when full
+    QueueStats filter, demod;
+};
+
+/**
+ * @brief Snapshot of the activity of the pipeline. The counters and histograms are only
+ * maintained when the library is built with the FMDEMOD_TELEMETRY option, the queue depths always
+ */
+struct FmDemodulatorTelemetry
+{
+    bool enabled = FMDEMOD_TELEMETRY;
+    // Conversion of the SDR samples, IQ resampler, demodulation and audio resampling
+    StageStats transform, filter, demod;
+    // From the call to `demodulate` to the delivery of the audio of the block
+    LatencyStats endToEnd;
+};
+
+/**
+ * @brief FM demodulation pipeline
+ * @tparam R The real type the samples are processed with: `double`, or `float` to halve the
+ * memory traffic and double the SIMD width
+ */
+template <typename R>
+class BasicFmDemodulator
+{
+    typedef BasicComplex<R> Sample;
+
 public:
-    FmDemodulator(const FmDemodulator &) = delete;
+    BasicFmDemodulator(const BasicFmDemodulator &) = delete;
     /**
      * @brief Construct a new Demodulator object
      *
      * @param sampleRate SDR Sample rate
      * @param audioSampleRate Output audio sample rate
+     * @param gain Digital gain
+     * @param options Pipeline settings
      */
-    FmDemodulator(std::function<void(const DataBuffer<int16_t> &)> demodCallback,
-                  int sampleRate, int audioSampleRate, float gain = 1.0f);
+    BasicFmDemodulator(std::function<void(const DataBuffer<int16_t> &)> demodCallback,
+                       int sampleRate, int audioSampleRate, float gain = 1.0f,
+                       const FmDemodulatorOptions &options = FmDemodulatorOptions());
+    /**
+     * @brief Construct a new Demodulator object writing the audio to a ring the consumer pulls it from.
+     * The audio is converted straight into the ring, and the demod stage never waits for the consumer:
+     * the audio of a block that does not fit in the ring is dropped, see `AudioRing::getOverruns`
+     *
+     * @param output The ring, which must outlive the demodulator
+     * @param sampleRate SDR Sample rate
+     * @param audioSampleRate Output audio sample rate
+     * @param gain Digital gain
+     * @param options Pipeline settings
+     */
+    BasicFmDemodulator(AudioRing &output, int sampleRate, int audioSampleRate, float gain = 1.0f,
+                       const FmDemodulatorOptions &options = FmDemodulatorOptions());
 
-    ~FmDemodulator();
+    ~BasicFmDemodulator();
 
     void demodulate(const DataBuffer<uint8_t> &buffer, size_t count);
     void demodulate(DataBuffer<uint8_t> &&buffer);
+    /**
+     * @brief Demodulate the samples of a buffer owned by the caller without copying them,
+     * such as the buffer of an SDR driver callback or a memory-mapped recording
+     *
+     * @param data The interleaved IQ bytes, which must stay valid until they are released
+     * @param count The number of bytes
+     * @param release Called with `data`, `count` and `arg` as soon as the samples have been converted,
+     * or dropped by the input queue. It can be called by any thread, including the caller of this function
+     * @param arg The argument passed to the release function
+     */
+    void demodulate(uint8_t *data, size_t count, DataBuffer<uint8_t>::ReleaseFunction release, void *arg);
+    /**
+     * @brief Change the settings of the pipeline. The filters are built by the calling thread, then the
+     * pipeline switches to them between two blocks without stopping: the blocks already pushed keep the
+     * previous settings, the next ones use the new settings. This function is thread safe
+     *
+     * @param settings The new settings
+     */
+    void reconfigure(const FmDemodulatorSettings &settings);
+    /**
+     * @return The settings of the last call to `reconfigure` or to a setter. This function is thread safe
+     */
+    FmDemodulatorSettings getSettings() const;
     /**
      * Set the new sample rate. This function is thread safe
      * @param sampleRate New sample rate
      */
     void setSampleRate(int sampleRate);
+    /**
+     * Set the new audio sample rate. This function is thread safe
+     * @param audioSampleRate New audio sample rate
+     */
+    void setAudioSampleRate(int audioSampleRate);
     /**
      * Set the new digital gain. This function is thread safe
      * @param gain The new digital gain
      */
     void setDigitalGain(float gain);
+    /**
+     * Set the frequency of the station relative to the center of the capture. This function is thread safe
+     * @param offset The new frequency offset, in Hz
+     */
+    void setFrequencyOffset(int offset);
     int getSampleRate() const;
+    int getAudioSampleRate() const;
     float getDigitalGain() const;
+    int getFrequencyOffset() const;
+    /**
+     * @return The sample rate the FM signal is demodulated at
+     */
+    int getIntermediateRate() const;
+    /**
+     * @return true if stereo decoding is enabled and the pilot is received. This function is thread safe
+     */
+    bool isStereo() const;
+    /**
+     * @return false if the thread configurations of the options could not be fully applied,
+     * typically the real-time priority without the permission
+     */
+    bool isThreadConfigApplied() const;
+    /**
+     * @return The overload counters of the queues. This function is thread safe
+     */
+    FmDemodulatorQueueStats getQueueStats() const;
+    /**
+     * @return The activity of the stages since the construction. This function is thread safe
+     */
+    FmDemodulatorTelemetry getTelemetry() const;
+    /**
+     * @return The group delay of the filters, in seconds, to which the duration of the blocks and
+     * the processing time add up in the latency of the audio
+     */
+    double getFilterDelay() const;
+
+    /**
+     * @brief Size of the blocks to push to keep the latency within the budget: the samples of a
+     * quarter of the budget, in multiples of the 512 bytes of the SDR USB transfers
+     *
+     * @param latencyBudget Latency budget, in seconds
+     * @param sampleRate SDR sample rate
+     * @return The number of bytes of the blocks
+     */
+    static size_t inputBlockSize(double latencyBudget, int sampleRate);
+
+    /**
+     * @brief Choose the rate the FM signal is demodulated at, between the SDR sample rate and the
+     * audio sample rate. The rate minimizes the estimated multiply-accumulates per second of the
+     * two resamplers and the discriminator, among the rates whose resampler phase tables are small
+     * enough to stay in cache
+     *
+     * @param sampleRate SDR sample rate
+     * @param audioSampleRate Output audio sample rate
+     * @return The intermediate sample rate
+     */
+    static int chooseIntermediateRate(int sampleRate, int audioSampleRate);
 
 private:
-    static constexpr int FM_DOWNSAMPLED = 220500;
     static constexpr int TRDPOOL_SZ = 1;
+    // Capacity of the rings between the stages, in blocks
+    static constexpr int STAGE_QUEUE_SIZE = 32;
+    static constexpr int IQ_TRANSITION = 40000;
+    static constexpr int AUDIO_TRANSITION = 4000;
+    // Fraction of the latency budget taken by the duration of a slice
+    static constexpr double LATENCY_SLICE_FRACTION = 0.25;
+    static constexpr size_t USB_TRANSFER_SIZE = 512;
+    // Range of the intermediate rate: the FM channel is 200 kHz wide, and the discriminator
+    // needs some oversampling to stay linear at full deviation
+    static constexpr int MIN_INTERMEDIATE_RATE = 220000;
+    static constexpr int MAX_INTERMEDIATE_RATE = 400000;
+    // Largest number of coefficients of the two resamplers phase tables, to fit a 256 KB cache
+    static constexpr int MAX_PHASE_TABLE_SIZE = 32768;
+    // Intermediate rate the digital gain is calibrated for, the discriminator output scales with the rate
+    static constexpr int GAIN_REFERENCE_RATE = 220500;
 
-    std::mutex filterMtx, sampleRateMtx, dGainMtx;
-    LowPass<Complex> lowPass;
-    LowPass<double> audioLowPass;
+    /**
+     * @brief Settings and filters of the pipeline, replaced as a whole by `reconfigure` and never modified
+     * once published. Every block holds the configuration it has been converted with, so a configuration
+     * is freed when the last block using it leaves the pipeline
+     */
+    struct Configuration
+    {
+        FmDemodulatorSettings settings;
+        int intermediateRate;
+        // Shared by the filter workers
+        std::shared_ptr<const RationalResampler<Sample>> iqResampler;
+        // Only used by the demod stage, which keeps their state from block to block. The next
+        // configuration shares them when it does not change the rates or the audio cutoff
+        std::shared_ptr<RationalResampler<R>> audioResampler;
+        std::shared_ptr<StereoDecoder<R>> stereoDecoder;
+    };
+
+    bool stereo;
+    // Serializes the calls to `reconfigure`, the stages never take it
+    mutable std::mutex configMtx;
+    // Configuration of the last call to `reconfigure`
+    std::shared_ptr<const Configuration> latestConfig;
+    // Configuration published by `reconfigure` and not yet picked up by the transform stage
+    std::atomic<std::shared_ptr<const Configuration> *> pendingConfig;
+    // Configuration of the next block, only accessed by the transform stage
+    std::shared_ptr<const Configuration> transformConfig;
+    // Configuration of the last demodulated block, only accessed by the demod stage
+    std::shared_ptr<const Configuration> demodConfig;
 
-    int sampleRate, audioSampleRate;
-    float digitalGain;
+    // Only accessed by the transform stage
+    IqConverter iqConverter;
+    // Brings the station to DC during the conversion, only accessed by the transform stage
+    Nco<R> nco;
+    // Offset and sample rate the oscillator has been set for, only accessed by the transform stage
+    int ncoFrequencyOffset, ncoSampleRate;
+    // Last converted samples, prepended to the next block as the history of the resampler
+    std::vector<Sample> iqHistory;
+    // Sequence number and stream position of the next IQ block
+    uint64_t nextSequence, streamPosition;
+    double latencyBudget;
+    // Set when blocks have been dropped before the block being converted, and forwarded with it
+    // so the next stages reset their state too
+    bool transformDiscontinuity;
+    // Only accessed by the demod stage
+    QuadratureDiscriminator<R> discriminator;
 
     std::function<void(const DataBuffer<int16_t> &)> demodCallback;
+    // Replaces the callback when set
+    AudioRing *audioOutput;
+    int filterWorkers;
 
-    DataProcessingThreadPool<DataBuffer<uint8_t>, TRDPOOL_SZ> sdrTransformPool;
-    DataProcessingThreadPool<DataBuffer<Complex>, TRDPOOL_SZ> filterPool;
-    DataProcessingThreadPool<DataBuffer<Complex>, TRDPOOL_SZ> demodPool;
+#if FMDEMOD_TELEMETRY
+    uint64_t startTime;
+    StageTelemetry transformTelemetry, filterTelemetry, demodTelemetry;
+    LatencyHistogram endToEndLatency;
+#endif
 
-    static void transformExecutor(DataBuffer<uint8_t> &data, void *arg);
-    static void filterExecutor(DataBuffer<Complex> &data, void *arg);
-    static void demodExecutor(DataBuffer<Complex> &data, void *arg);
+    // Memory of the buffers produced by each stage, given back when the next stage is done with them.
+    // Declared before the thread pools, which release their queued buffers when they are destroyed
+    BufferPool inputBuffers, iqBuffers, resampledBuffers, demodBuffers;
+
+    struct InputBlock
+    {
+        DataBuffer<uint8_t> data;
+        TelemetryTimestamp received;
+    };
+
+    /**
+     * @brief Converted IQ samples, resampled by any of the filter workers
+     */
+    struct IqBlock
+    {
+        uint64_t sequence;
+        // Index in the stream of the first sample after the history
+        uint64_t position;
+        bool discontinuity;
+        std::shared_ptr<const Configuration> config;
+        // The history of the resampler followed by the samples of the block
+        DataBuffer<Sample> samples;
+        TelemetryTimestamp received;
+    };
+
+    struct ResampledBlock
+    {
+        DataBuffer<Sample> samples;
+        std::shared_ptr<const Configuration> config;
+        bool discontinuity;
+        TelemetryTimestamp received;
+    };
+
+    struct DemodBlock
+    {
+        DataBuffer<Sample> samples;
+        std::shared_ptr<const Configuration> config;
+        TelemetryTimestamp received;
+    };
+
+    // Slices of the block being converted, pushed to the filter stage once the input is released.
+    // Only accessed by the transform stage
+    std::vector<IqBlock> slices;
+
+    // In reverse pipeline order: each stage is stopped before the stage it feeds is destroyed.
+    // The input can come from any thread, the demod stage is fed in order by the reorder buffer
+    // through a lock-free ring
+    SpscProcessingThread<DemodBlock> demodPool;
+    ReorderBuffer<ResampledBlock> reorderBuffer;
+    DataProcessingThreadPool<IqBlock, TRDPOOL_SZ> filterPool;
+    DataProcessingThreadPool<InputBlock, TRDPOOL_SZ> sdrTransformPool;
+
+    static void transformExecutor(InputBlock &block, void *arg);
+    static void filterExecutor(IqBlock &block, void *arg);
+    static void releaseExecutor(ResampledBlock &block, void *arg);
+    static void demodExecutor(DemodBlock &block, void *arg);
+    static void demodulateBlock(BasicFmDemodulator *_this, DemodBlock &block);
+    /**
+     * @brief Convert the audio of a block to 16 bits, into the output ring or a buffer passed to the callback
+     */
+    static void deliverAudio(BasicFmDemodulator *_this, const R *audio, size_t count, float gain);
+    /**
+     * @brief Build the filters of the settings, reusing the ones of the previous configuration that do not change
+     */
+    std::shared_ptr<const Configuration> makeConfiguration(const FmDemodulatorSettings &settings,
+                                                           const Configuration *previous) const;
+    /**
+     * @brief Make the settings the latest configuration and hand it to the transform stage, with `configMtx` held
+     */
+    void publishConfiguration(const FmDemodulatorSettings &settings);
+    static void transformDiscontinuityHandler(void *arg);
+    static void demodDiscontinuityHandler(void *arg);
 
     template <typename T>
     static inline int16_t coerceToInt16(T value)
@@ -78,3 +409,6 @@ private:
         return (int16_t)std::max(min, std::min(max, value));
     }
 };
+
+typedef BasicFmDemodulator<double> FmDemodulator;
+typedef BasicFmDemodulator<float> FmDemodulatorF;
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "Complex.h"
+#include "RationalResampler.h"
+#include "FmDemodulator.h"
+#include "ReorderBuffer.h"
+#include "DataBuffer.h"
+#include "BufferPool.h"
+
+/**
+ * @brief Offline FM demodulation of a recording, such as a memory-mapped `.cu8` file.
+ * The recording is split in chunks demodulated in parallel by all the cores. Every chunk starts
+ * early enough to fill the history of the resamplers and the discriminator, and its resamplers
+ * run at the stream positions of the chunk, so the chunks join without seams and the audio is
+ * the one the streaming `BasicFmDemodulator` produces with the same settings.
+ * The DC offset removal starts over at every chunk, and stereo decoding is refused: the PLL state
+ * at a chunk boundary can not be recovered from a short warm-up
+ * @tparam R The real type the samples are processed with
+ */
+template <typename R>
+class BasicFmFileDemodulator
+{
+    typedef BasicComplex<R> Sample;
+
+public:
+    typedef std::function<void(const DataBuffer<int16_t> &)> DemodCallback;
+
+    BasicFmFileDemodulator(const BasicFmFileDemodulator &) = delete;
+    /**
+     * @brief Construct a new File Demodulator object
+     *
+     * @param sampleRate Sample rate of the recording
+     * @param audioSampleRate Output audio sample rate
+     * @param gain Digital gain
+     * @param options Pipeline settings, `overflowPolicy`, `filterWorkers` and the threads are not used.
+     * `stereo` is not supported: the demodulation fails
+     * @param threads Number of threads, 0 for one per core
+     * @param chunkSize Number of IQ samples of the chunks
+     */
+    BasicFmFileDemodulator(int sampleRate, int audioSampleRate, float gain = 1.0f,
+                           const FmDemodulatorOptions &options = FmDemodulatorOptions(),
+                           int threads = 0, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /**
+     * @brief Demodulate a recording of interleaved unsigned 8 bit IQ samples
+     *
+     * @param path Path of the recording
+     * @param callback Receives the audio of every chunk, in order. It is called by the worker
+     * threads, one call at a time
+     * @return false if the file can not be opened or mapped, or stereo decoding is requested
+     */
+    bool demodulateFile(const std::string &path, const DemodCallback &callback);
+    /**
+     * @brief Demodulate a recording in memory, returning when all of its audio has been delivered
+     *
+     * @param data The interleaved IQ bytes
+     * @param size The number of bytes
+     * @param callback Receives the audio of every chunk, in order. It is called by the worker
+     * threads, one call at a time
+     * @return false if stereo decoding is requested
+     */
+    bool demodulate(const uint8_t *data, size_t size, const DemodCallback &callback);
+
+    int getIntermediateRate() const;
+    int getThreads() const;
+
+private:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 1 << 22;
+    // Chunks per thread that can be taken ahead of the oldest chunk not delivered yet, which bounds
+    // the audio waiting in the reorder buffer when a worker falls behind
+    static constexpr size_t CHUNKS_AHEAD_PER_THREAD = 2;
+    static constexpr int IQ_CUTOFF = 100000;
+    static constexpr int IQ_TRANSITION = 40000;
+    static constexpr int AUDIO_CUTOFF = 20000;
+    static constexpr int AUDIO_TRANSITION = 4000;
+    static constexpr int GAIN_REFERENCE_RATE = 220500;
+
+    int sampleRate, audioSampleRate, intermediateRate;
+    float digitalGain;
+    FmDemodulatorOptions options;
+    int threads;
+    size_t chunkSize;
+    // Only used through `resampleAt`, which the workers can call concurrently
+    RationalResampler<Sample> iqResampler;
+    RationalResampler<R> audioResampler;
+    BufferPool buffers;
+
+    /**
+     * @brief A recording being demodulated, shared by the workers
+     */
+    struct Job
+    {
+        BasicFmFileDemodulator *owner;
+        const uint8_t *data;
+        size_t samples;
+        size_t chunks;
+        // Next chunk to take and number of chunks delivered, guarded by the mutex
+        size_t nextChunk, released;
+        std::mutex mtx;
+        // Signaled when a chunk has been delivered
+        std::condition_variable cv;
+        const DemodCallback *callback;
+        ReorderBuffer<DataBuffer<int16_t>> *reorderBuffer;
+    };
+
+    DataBuffer<int16_t> demodulateChunk(const uint8_t *data, size_t samples, size_t chunk);
+
+    static void *worker(void *arg);
+    static void releaseExecutor(DataBuffer<int16_t> &audio, void *arg);
+
+    template <typename T>
+    static inline int16_t coerceToInt16(T value)
+    {
+        static constexpr T min = std::numeric_limits<int16_t>::min();
+        static constexpr T max = std::numeric_limits<int16_t>::max();
+        return (int16_t)std::max(min, std::min(max, value));
+    }
+};
+
+typedef BasicFmFileDemodulator<double> FmFileDemodulator;
+typedef BasicFmFileDemodulator<float> FmFileDemodulatorF;
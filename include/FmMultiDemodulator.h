@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stdlib.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <functional>
+#include <atomic>
+#include "Complex.h"
+#include "PolyphaseChannelizer.h"
+#include "RationalResampler.h"
+#include "IqConverter.h"
+#include "Nco.h"
+#include "StereoDecoder.h"
+#include "QuadratureDiscriminator.h"
+#include "DataProcessingThreadPool.h"
+#include "SpscProcessingThread.h"
+#include "QueuePolicy.h"
+#include "FmDemodulator.h"
+#include "DataBuffer.h"
+#include "BufferPool.h"
+
+/**
+ * @brief FM demodulation of several stations of one wideband capture.
+ * The SDR samples are converted once and split by a single `PolyphaseChannelizer` in channels
+ * of at least 400 kHz. Every station takes the channel nearest to it, and its own thread shifts
+ * the station to DC, resamples it to the demodulation rate, demodulates it and resamples the audio.
+ * The cost of the front-end does not depend on the number of stations, and each station only
+ * processes the narrow rate of its channel
+ * @tparam R The real type the samples are processed with
+ */
+template <typename R>
+class BasicFmMultiDemodulator
+{
+    typedef BasicComplex<R> Sample;
+
+public:
+    typedef std::function<void(size_t station, const DataBuffer<int16_t> &)> DemodCallback;
+
+    BasicFmMultiDemodulator(const BasicFmMultiDemodulator &) = delete;
+    /**
+     * @brief Construct a new Multi Demodulator object
+     *
+     * @param demodCallback Receives the audio of every station, with the index of the station in `stationOffsets`.
+     * It is called by the thread of the station, so different stations call it concurrently
+     * @param sampleRate SDR Sample rate
+     * @param audioSampleRate Output audio sample rate
+     * @param stationOffsets Frequency of every station relative to the center of the capture, in Hz
+     * @param gain Digital gain
+     * @param options Pipeline settings, `filterWorkers`, `frequencyOffset`, `latencyBudget` and
+     * `filterThreads` are not used
+     */
+    BasicFmMultiDemodulator(DemodCallback demodCallback, int sampleRate, int audioSampleRate,
+                            const std::vector<int> &stationOffsets, float gain = 1.0f,
+                            const FmDemodulatorOptions &options = FmDemodulatorOptions());
+
+    ~BasicFmMultiDemodulator();
+
+    void demodulate(const DataBuffer<uint8_t> &buffer, size_t count);
+    void demodulate(DataBuffer<uint8_t> &&buffer);
+    /**
+     * @brief Demodulate the samples of a buffer owned by the caller without copying them,
+     * such as the buffer of an SDR driver callback or a memory-mapped recording
+     *
+     * @param data The interleaved IQ bytes, which must stay valid until they are released
+     * @param count The number of bytes
+     * @param release Called with `data`, `count` and `arg` as soon as the samples have been converted,
+     * or dropped by the input queue. It can be called by any thread, including the caller of this function
+     * @param arg The argument passed to the release function
+     */
+    void demodulate(uint8_t *data, size_t count, DataBuffer<uint8_t>::ReleaseFunction release, void *arg);
+    /**
+     * Set the new digital gain. This function is thread safe
+     * @param gain The new digital gain
+     */
+    void setDigitalGain(float gain);
+    float getDigitalGain() const;
+    size_t getStationCount() const;
+    /**
+     * @return The sample rate of the channels
+     */
+    int getChannelRate() const;
+    /**
+     * @return The sample rate the stations are demodulated at
+     */
+    int getIntermediateRate() const;
+    /**
+     * @return true if stereo decoding is enabled and the pilot of the station is received. This function is thread safe
+     */
+    bool isStereo(size_t station) const;
+    /**
+     * @return The overload counters of the input queue. This function is thread safe
+     */
+    QueueStats getQueueStats() const;
+    /**
+     * @return false if the thread configurations of the options could not be fully applied,
+     * typically the real-time priority without the permission
+     */
+    bool isThreadConfigApplied() const;
+
+    /**
+     * @brief Number of channels of the filterbank: the most channels that are still wide enough
+     * for a station anywhere in them, with a margin for the filter transitions, and whose half
+     * divides the sample rate so the channel rate is exact
+     *
+     * @param sampleRate SDR sample rate
+     * @return The number of channels, always even
+     */
+    static int chooseChannels(int sampleRate);
+
+private:
+    // Capacity of the ring of every station, in blocks
+    static constexpr int STATION_QUEUE_SIZE = 32;
+    static constexpr int IQ_CUTOFF = 100000;
+    static constexpr int IQ_TRANSITION = 40000;
+    static constexpr int AUDIO_CUTOFF = 20000;
+    static constexpr int AUDIO_TRANSITION = 4000;
+    static constexpr int GAIN_REFERENCE_RATE = 220500;
+    // A station can be up to half a channel away from the channel center, so the channel filter
+    // passes half a spacing plus the station bandwidth. The channels are oversampled by 2, and the
+    // filter transition is the spacing minus the station bandwidth
+    static constexpr int MIN_CHANNEL_SPACING = 400000;
+
+    /**
+     * @brief Demodulation chain of one station, run by its own thread
+     */
+    struct Station
+    {
+        Station(BasicFmMultiDemodulator *owner, size_t index, int channel, double offset,
+                const FmDemodulatorOptions &options);
+
+        BasicFmMultiDemodulator *owner;
+        size_t index;
+        int channel;
+        // Brings the station from its offset relative to the channel center to DC
+        Nco<R> nco;
+        RationalResampler<Sample> iqResampler;
+        QuadratureDiscriminator<R> discriminator;
+        // Only one of the two is built: the stereo decoder resamples the audio itself
+        std::unique_ptr<RationalResampler<R>> audioResampler;
+        std::unique_ptr<StereoDecoder<R>> stereoDecoder;
+        BufferPool buffers;
+        // Declared last, the thread stops before the rest of the station is destroyed
+        SpscProcessingThread<DataBuffer<Sample>> stage;
+    };
+
+    // Read by every station block without locking
+    std::atomic<float> digitalGain;
+    int sampleRate, audioSampleRate;
+    // Number of channels of the filterbank, declared before the members initialized from it
+    int channels;
+    int channelRate, intermediateRate;
+    DemodCallback demodCallback;
+
+    // Only accessed by the channelizer stage
+    IqConverter iqConverter;
+    PolyphaseChannelizer<R> channelizer;
+    // Channel block of every station, and the buffer every channel is written to
+    std::vector<std::optional<DataBuffer<Sample>>> stationBlocks;
+    std::vector<Sample *> channelOutputs;
+    bool discontinuity;
+
+    BufferPool inputBuffers, iqBuffers, channelBuffers;
+
+    // Destroyed after the channelizer stage that feeds them
+    std::vector<std::unique_ptr<Station>> stations;
+    DataProcessingThreadPool<DataBuffer<uint8_t>> channelizerPool;
+
+    static void channelizerExecutor(DataBuffer<uint8_t> &data, void *arg);
+    static void channelizerDiscontinuityHandler(void *arg);
+    static void stationExecutor(DataBuffer<Sample> &data, void *arg);
+    static void stationDiscontinuityHandler(void *arg);
+
+    template <typename T>
+    static inline int16_t coerceToInt16(T value)
+    {
+        static constexpr T min = std::numeric_limits<int16_t>::min();
+        static constexpr T max = std::numeric_limits<int16_t>::max();
+        return (int16_t)std::max(min, std::min(max, value));
+    }
+};
+
+typedef BasicFmMultiDemodulator<double> FmMultiDemodulator;
+typedef BasicFmMultiDemodulator<float> FmMultiDemodulatorF;
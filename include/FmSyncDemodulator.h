@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "Complex.h"
+#include "RationalResampler.h"
+#include "IqConverter.h"
+#include "Nco.h"
+#include "QuadratureDiscriminator.h"
+#include "StereoDecoder.h"
+#include "FmDemodulator.h"
+#include "DataBuffer.h"
+#include "BufferPool.h"
+
+/**
+ * @brief FM demodulation on the calling thread, for applications running their own scheduler.
+ * `demodulate` converts, filters, demodulates and resamples the block, then calls the callback
+ * with its audio before returning. The stages run one tile of `TILE_SIZE` IQ samples at a time,
+ * so the intermediate samples of a tile stay in the L1 and L2 caches from one stage to the next.
+ * No thread is created. The audio is numerically close to the one of `BasicFmDemodulator` with the
+ * same settings, not identical: the NCO seeds its phasors again, and the DC offset estimate when
+ * it is removed is updated, at tile boundaries instead of block boundaries, which rounds the
+ * samples differently
+ * @tparam R The real type the samples are processed with
+ */
+template <typename R>
+class BasicFmSyncDemodulator
+{
+    typedef BasicComplex<R> Sample;
+
+public:
+    BasicFmSyncDemodulator(const BasicFmSyncDemodulator &) = delete;
+    /**
+     * @brief Construct a new Sync Demodulator object
+     *
+     * @param demodCallback Receives the audio of every block, before `demodulate` returns
+     * @param sampleRate SDR Sample rate
+     * @param audioSampleRate Output audio sample rate
+     * @param gain Digital gain
+     * @param options Pipeline settings, `overflowPolicy` and `filterWorkers` are not used
+     */
+    BasicFmSyncDemodulator(std::function<void(const DataBuffer<int16_t> &)> demodCallback,
+                           int sampleRate, int audioSampleRate, float gain = 1.0f,
+                           const FmDemodulatorOptions &options = FmDemodulatorOptions());
+
+    /**
+     * @brief Demodulate the samples of a block
+     *
+     * @param data The interleaved IQ bytes
+     * @param count The number of bytes
+     */
+    void demodulate(const uint8_t *data, size_t count);
+    void demodulate(const DataBuffer<uint8_t> &buffer, size_t count);
+    /**
+     * @brief Start over as a new stream, forgetting the filter and discriminator state
+     */
+    void reset();
+    /**
+     * Set the new digital gain, from the thread calling `demodulate`
+     * @param gain The new digital gain
+     */
+    void setDigitalGain(float gain);
+    /**
+     * Set the frequency of the station relative to the center of the capture, from the thread calling `demodulate`
+     * @param offset The new frequency offset, in Hz
+     */
+    void setFrequencyOffset(int offset);
+    float getDigitalGain() const;
+    int getFrequencyOffset() const;
+    int getIntermediateRate() const;
+    /**
+     * @return true if stereo decoding is enabled and the pilot is received
+     */
+    bool isStereo() const;
+
+private:
+    // IQ samples processed by all the stages at once: 64 KB of complex doubles
+    static constexpr size_t TILE_SIZE = 4096;
+    static constexpr int IQ_CUTOFF = 100000;
+    static constexpr int IQ_TRANSITION = 40000;
+    static constexpr int AUDIO_CUTOFF = 20000;
+    static constexpr int AUDIO_TRANSITION = 4000;
+    static constexpr int GAIN_REFERENCE_RATE = 220500;
+
+    int sampleRate, audioSampleRate, intermediateRate;
+    float digitalGain;
+    int frequencyOffset;
+    std::function<void(const DataBuffer<int16_t> &)> demodCallback;
+
+    IqConverter iqConverter;
+    Nco<R> nco;
+    RationalResampler<Sample> iqResampler;
+    QuadratureDiscriminator<R> discriminator;
+    // Only one of the two is built: the stereo decoder resamples the audio itself
+    std::unique_ptr<RationalResampler<R>> audioResampler;
+    std::unique_ptr<StereoDecoder<R>> stereoDecoder;
+
+    // Outputs of every stage for one tile
+    std::vector<Sample> iqTile, resampledTile;
+    std::vector<R> demodulatedTile, audioTile;
+    BufferPool audioBuffers;
+
+    /**
+     * @brief Run all the stages on one tile
+     *
+     * @return The number of audio samples written
+     */
+    size_t demodulateTile(const uint8_t *data, size_t count, int16_t *audio);
+
+    template <typename T>
+    static inline int16_t coerceToInt16(T value)
+    {
+        static constexpr T min = std::numeric_limits<int16_t>::min();
+        static constexpr T max = std::numeric_limits<int16_t>::max();
+        return (int16_t)std::max(min, std::min(max, value));
+    }
+};
+
+typedef BasicFmSyncDemodulator<double> FmSyncDemodulator;
+typedef BasicFmSyncDemodulator<float> FmSyncDemodulatorF;
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include "Complex.h"
+#include "Nco.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Converter of the unsigned 8 bit interleaved IQ samples of the SDR to `Complex` or `ComplexF` samples.
+ * Every byte is converted as `(byte - offset) * scale` in a single pass over the buffer, using
+ * AVX2 or SSE2 when the build targets them and a 256-entry lookup table otherwise.
+ * The offset is the ADC middle point, or the DC offset of the I and Q channels tracked by
+ * the same pass when the DC removal is enabled. The conversion can be fused with an `Nco`
+ * frequency shift, applied to every chunk of samples while it is still in the L1 cache
+ */
+class IqConverter
+{
+public:
+    /**
+     * @brief Construct a new IqConverter object
+     *
+     * @param removeDcOffset Track and remove the DC offset of the I and Q channels
+     * @param scale Scale applied to the samples
+     */
+    IqConverter(bool removeDcOffset = false, double scale = 1.0)
+        : removeDcOffset(removeDcOffset), scale(scale), offsetRe(ADC_MIDDLE), offsetIm(ADC_MIDDLE)
+    {
+        updateTables();
+    }
+
+    /**
+     * @brief Convert the IQ samples
+     *
+     * @tparam R The real type of the output samples
+     * @param input The interleaved IQ bytes
+     * @param count The number of complex samples (half the number of bytes)
+     * @param output The converted samples
+     */
+    template <typename R>
+    void convert(const uint8_t *input, size_t count, BasicComplex<R> *output)
+    {
+        uint64_t sumRe = 0, sumIm = 0;
+        convertChunk(input, count, output, sumRe, sumIm);
+
+        if (removeDcOffset && count > 0)
+        {
+            updateOffset(sumRe, sumIm, count);
+        }
+    }
+
+    /**
+     * @brief Convert the IQ samples and shift them in frequency, in a single pass over the memory
+     *
+     * @tparam R The real type of the output samples
+     * @param input The interleaved IQ bytes
+     * @param count The number of complex samples (half the number of bytes)
+     * @param output The converted and shifted samples
+     * @param nco The oscillator the samples are shifted with
+     */
+    template <typename R>
+    void convert(const uint8_t *input, size_t count, BasicComplex<R> *output, Nco<R> &nco)
+    {
+        uint64_t sumRe = 0, sumIm = 0;
+        for (size_t i = 0; i < count; i += FUSED_CHUNK)
+        {
+            size_t n = std::min(FUSED_CHUNK, count - i);
+            convertChunk(input + 2 * i, n, output + i, sumRe, sumIm);
+            nco.shift(output + i, n);
+        }
+
+        if (removeDcOffset && count > 0)
+        {
+            updateOffset(sumRe, sumIm, count);
+        }
+    }
+
+    /**
+     * @return The name of the conversion kernel selected at build time
+     */
+    static const char *kernelName()
+    {
+#if defined(__AVX2__)
+        return "avx2";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "lut";
+#endif
+    }
+
+private:
+    static constexpr double ADC_MIDDLE = 128.0;
+    // Number of samples the DC offset estimate is averaged over
+    static constexpr double DC_TIME_CONSTANT = 1 << 20;
+    // Samples converted before being shifted, 8 KB of complex doubles
+    static constexpr size_t FUSED_CHUNK = 512;
+
+    bool removeDcOffset;
+    double scale;
+    double offsetRe, offsetIm;
+    // The conversion is byte * scale + bias
+    double biasRe, biasIm;
+    double lutRe[256], lutIm[256];
+    float lutReF[256], lutImF[256];
+
+    template <typename R>
+    const R *lookupRe() const;
+    template <typename R>
+    const R *lookupIm() const;
+
+    template <typename R>
+    void convertChunk(const uint8_t *input, size_t count, BasicComplex<R> *output, uint64_t &sumRe, uint64_t &sumIm) const
+    {
+        R *out = reinterpret_cast<R *>(output);
+        const R *lutRe = lookupRe<R>();
+        const R *lutIm = lookupIm<R>();
+        size_t bytes = count * 2;
+        size_t i = convertVectorized(input, bytes, out, sumRe, sumIm);
+
+        for (; i + 2 <= bytes; i += 2)
+        {
+            out[i] = lutRe[input[i]];
+            out[i + 1] = lutIm[input[i + 1]];
+            sumRe += input[i];
+            sumIm += input[i + 1];
+        }
+    }
+
+    void updateTables()
+    {
+        biasRe = -offsetRe * scale;
+        biasIm = -offsetIm * scale;
+        for (int i = 0; i < 256; i++)
+        {
+            lutRe[i] = i * scale + biasRe;
+            lutIm[i] = i * scale + biasIm;
+            lutReF[i] = (float)lutRe[i];
+            lutImF[i] = (float)lutIm[i];
+        }
+    }
+
+    void updateOffset(uint64_t sumRe, uint64_t sumIm, size_t count)
+    {
+        // Exponential average of the block means, weighted by the block length
+        double alpha = 1.0 - exp(-(double)count / DC_TIME_CONSTANT);
+        offsetRe += alpha * ((double)sumRe / count - offsetRe);
+        offsetIm += alpha * ((double)sumIm / count - offsetIm);
+        updateTables();
+    }
+
+    /**
+     * @brief Convert the leading multiple of 16 bytes with the SIMD kernel of the build
+     *
+     * @return The number of bytes converted
+     */
+    size_t convertVectorized(const uint8_t *input, size_t bytes, double *out, uint64_t &sumRe, uint64_t &sumIm) const
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256d vScale = _mm256_set1_pd(scale);
+        const __m256d vBias = _mm256_setr_pd(biasRe, biasIm, biasRe, biasIm);
+        for (; i + 16 <= bytes; i += 16)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+            __m256i lo = _mm256_cvtepu8_epi32(raw);
+            __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(raw, 8));
+            _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(lo)), vScale), vBias));
+            _mm256_storeu_pd(out + i + 4, _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(lo, 1)), vScale), vBias));
+            _mm256_storeu_pd(out + i + 8, _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(hi)), vScale), vBias));
+            _mm256_storeu_pd(out + i + 12, _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(hi, 1)), vScale), vBias));
+            if (removeDcOffset)
+            {
+                accumulate(raw, sumRe, sumIm);
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128d vScale = _mm_set1_pd(scale);
+        const __m128d vBias = _mm_setr_pd(biasRe, biasIm);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= bytes; i += 16)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+            __m128i words[2] = {_mm_unpacklo_epi8(raw, zero), _mm_unpackhi_epi8(raw, zero)};
+            for (int w = 0; w < 2; w++)
+            {
+                __m128i lo = _mm_unpacklo_epi16(words[w], zero);
+                __m128i hi = _mm_unpackhi_epi16(words[w], zero);
+                double *dst = out + i + w * 8;
+                _mm_storeu_pd(dst, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(lo), vScale), vBias));
+                _mm_storeu_pd(dst + 2, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)), vScale), vBias));
+                _mm_storeu_pd(dst + 4, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(hi), vScale), vBias));
+                _mm_storeu_pd(dst + 6, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)), vScale), vBias));
+            }
+            if (removeDcOffset)
+            {
+                accumulate(raw, sumRe, sumIm);
+            }
+        }
+#endif
+        return i;
+    }
+
+    size_t convertVectorized(const uint8_t *input, size_t bytes, float *out, uint64_t &sumRe, uint64_t &sumIm) const
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 vScale = _mm256_set1_ps((float)scale);
+        const __m256 vBias = _mm256_setr_ps((float)biasRe, (float)biasIm, (float)biasRe, (float)biasIm,
+                                            (float)biasRe, (float)biasIm, (float)biasRe, (float)biasIm);
+        for (; i + 16 <= bytes; i += 16)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+            __m256i lo = _mm256_cvtepu8_epi32(raw);
+            __m256i hi = _mm256_cvtepu8_epi32(_mm_srli_si128(raw, 8));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), vScale), vBias));
+            _mm256_storeu_ps(out + i + 8, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), vScale), vBias));
+            if (removeDcOffset)
+            {
+                accumulate(raw, sumRe, sumIm);
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128 vScale = _mm_set1_ps((float)scale);
+        const __m128 vBias = _mm_setr_ps((float)biasRe, (float)biasIm, (float)biasRe, (float)biasIm);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= bytes; i += 16)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+            __m128i words[2] = {_mm_unpacklo_epi8(raw, zero), _mm_unpackhi_epi8(raw, zero)};
+            for (int w = 0; w < 2; w++)
+            {
+                float *dst = out + i + w * 8;
+                _mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words[w], zero)), vScale), vBias));
+                _mm_storeu_ps(dst + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(words[w], zero)), vScale), vBias));
+            }
+            if (removeDcOffset)
+            {
+                accumulate(raw, sumRe, sumIm);
+            }
+        }
+#endif
+        return i;
+    }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    static inline void accumulate(__m128i raw, uint64_t &sumRe, uint64_t &sumIm)
+    {
+        // I bytes are the low bytes of every 16 bit lane, Q bytes the high ones
+        const __m128i zero = _mm_setzero_si128();
+        __m128i re = _mm_sad_epu8(_mm_and_si128(raw, _mm_set1_epi16(0x00FF)), zero);
+        __m128i im = _mm_sad_epu8(_mm_srli_epi16(raw, 8), zero);
+        // Each 64 bit lane holds the sum of 4 bytes, which fits the low 32 bits
+        sumRe += (uint32_t)_mm_cvtsi128_si32(re) + (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(re, re));
+        sumIm += (uint32_t)_mm_cvtsi128_si32(im) + (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(im, im));
+    }
+#endif
+};
+
+template <>
+inline const double *IqConverter::lookupRe<double>() const
+{
+    return lutRe;
+}
+
+template <>
+inline const double *IqConverter::lookupIm<double>() const
+{
+    return lutIm;
+}
+
+template <>
+inline const float *IqConverter::lookupRe<float>() const
+{
+    return lutReF;
+}
+
+template <>
+inline const float *IqConverter::lookupIm<float>() const
+{
+    return lutImF;
+}
@@ -8,122 +8,192 @@
 #include <fftw3.h>
 #include <string.h>
 #include <type_traits>
+#include <mutex>
+#include <algorithm>
+#include "Complex.h"
 #include "DataBuffer.h"
-
-template<typename T> struct is_complex_type final : std::false_type {
-};
-
-template<> struct is_complex_type<Complex> final : std::true_type {
-};
-
+#include "FftPlanner.h"
+#include "FirDesign.h"
+
+/**
+ * @brief Streaming low-pass filter based on the overlap-save fast convolution.
+ * The last `taps - 1` input samples are kept between calls, so consecutive buffers are filtered
+ * as a single continuous stream, whatever their size. The filter length only sets the filter
+ * quality, while the FFT size only sets the block processed by each transform.
+ * The working state belongs to the instance, so different filters run concurrently without locking.
+ * A single instance must not be used by several threads at once.
+ * The demodulators no longer use it: `RationalResampler` filters and resamples in one pass. It is
+ * kept for applications filtering without changing the rate, and as a baseline for the benchmark.
+ * @tparam T The data type (`Complex`, `ComplexF`, `double` or `float`), the FFTW precision follows its real type
+ */
 template<typename T>
 class LowPass {
+    typedef typename real_type<T>::type R;
+    typedef Fftw<R> FFT;
+
 public:
     LowPass() = delete;
     LowPass(const LowPass &) = delete;
 
-    LowPass(std::mutex& mtx, int frequency, int N, int sampleRate) : mtx(mtx), 
-            frequency(frequency), N(N) {
-        generateCoefficients(sampleRate);
-        generateComplexCoefficients(sampleRate);
+    /**
+     * @brief Construct a new LowPass object. The FFT plans are created once here and reused
+     * for every block
+     *
+     * @param frequency Cut-off frequency
+     * @param N FFT size
+     * @param sampleRate Sample rate of the filtered data
+     * @param taps Filter length, must be lower than the FFT size
+     * @param rigor FFTW planning rigor
+     */
+    LowPass(int frequency, int N, int sampleRate, int taps,
+            FftPlannerRigor rigor = FftPlannerRigor::Estimate) : frequency(frequency), N(N), taps(taps),
+            step(N - taps + 1), history(taps - 1) {
+        assert(taps > 0 && taps < N);
+        createPlans(static_cast<unsigned>(rigor));
+        generateResponse(sampleRate);
+        reset();
     }
 
     ~LowPass() {
+        std::lock_guard<std::mutex> lock(FftPlanner::mutex());
+        FFT::destroyPlan(forwardPlan);
+        FFT::destroyPlan(inversePlan);
+        FFT::free(block);
+        FFT::free(spectrum);
+        FFT::free(response);
+    }
+
+    /**
+     * @brief Clear the filter history, the next buffer is filtered as the start of a new stream
+     */
+    void reset() {
+        std::fill(history.begin(), history.end(), T{});
     }
 
     template<typename Type = T>
-    auto filter(DataBuffer<Complex>& data) -> typename std::enable_if<is_complex_type<Type>::value>::type {
-        size_t currentIndex = 0;
-        
-        std::lock_guard<std::mutex> lock(mtx);
-        fftw_complex* outputFft = fftw_alloc_complex(N);
+    auto filter(DataBuffer<T>& data) -> typename std::enable_if<is_complex_type<Type>::value>::type {
+        T* timeBlock = reinterpret_cast<T*>(block);
 
-        while (currentIndex + N < data.size()) {
-            fftw_plan dfftPlan = fftw_plan_dft_1d(N, (fftw_complex *) &data[currentIndex], outputFft, FFTW_FORWARD, FFTW_ESTIMATE);
+        for (size_t currentIndex = 0; currentIndex < data.size(); currentIndex += step) {
+            size_t count = loadBlock(data, currentIndex);
 
-            fftw_execute(dfftPlan);
+            FFT::execute(forwardPlan);
 
             // Execute convolution in frequency domain (it's a multiplication with the filter frequency response)
-            for (size_t i = 0; i < N; i++) {
-                outputFft[i][0] *= complexCoefficients[i];
-                outputFft[i][1] *= complexCoefficients[i];
-            }
-            fftw_destroy_plan(dfftPlan);
-            
-            fftw_plan ifftPlan = fftw_plan_dft_1d(N, outputFft, (fftw_complex *) &data[currentIndex], FFTW_BACKWARD, FFTW_ESTIMATE);
-            fftw_execute(ifftPlan);
-            
-            // At this point the filtered signal has a unwanted multiplicative factor of N
-            for (size_t i = 0; i < N; i++) {
-                data[currentIndex + i] /= N;
+            for (int i = 0; i < N; i++) {
+                R re = spectrum[i][0] * response[i][0] - spectrum[i][1] * response[i][1];
+                R im = spectrum[i][0] * response[i][1] + spectrum[i][1] * response[i][0];
+                spectrum[i][0] = re;
+                spectrum[i][1] = im;
             }
 
-            fftw_destroy_plan(ifftPlan);
-            currentIndex += N;
-        }
+            FFT::execute(inversePlan);
 
-        fftw_free(outputFft);
+            // The first taps - 1 outputs are corrupted by the circular wrap-around, the rest is the linear convolution
+            memcpy(&data[currentIndex], timeBlock + taps - 1, sizeof(T) * count);
+        }
     }
 
     template<typename Type = T>
     auto filter(DataBuffer<T>& data) -> typename std::enable_if<!is_complex_type<Type>::value>::type {
-        size_t currentIndex = 0;
-        
-        std::lock_guard<std::mutex> lock(mtx);
-        fftw_complex *outputFft = fftw_alloc_complex(N);
+        R* timeBlock = reinterpret_cast<R*>(block);
+
+        for (size_t currentIndex = 0; currentIndex < data.size(); currentIndex += step) {
+            size_t count = loadBlock(data, currentIndex);
 
-        while (currentIndex + N < data.size()) {            
-            fftw_plan dfftPlan = fftw_plan_dft_r2c_1d(N, &data[currentIndex], outputFft, FFTW_ESTIMATE);
-            fftw_execute(dfftPlan);
+            FFT::execute(forwardPlan);
 
             // Execute convolution in frequency domain (it's a multiplication with the filter frequency response)
-            for (size_t i = 0; i < N; i++) {
-                outputFft[i][0] *= coefficients[i];
+            // The real transform only holds the N / 2 + 1 non-redundant bins
+            for (int i = 0; i < N / 2 + 1; i++) {
+                R re = spectrum[i][0] * response[i][0] - spectrum[i][1] * response[i][1];
+                R im = spectrum[i][0] * response[i][1] + spectrum[i][1] * response[i][0];
+                spectrum[i][0] = re;
+                spectrum[i][1] = im;
             }
-            fftw_destroy_plan(dfftPlan);
-            
-            fftw_plan ifftPlan = fftw_plan_dft_c2r_1d(N, outputFft, &data[currentIndex], FFTW_ESTIMATE);
-            fftw_execute(ifftPlan);
-            // At this point the filtered signal has a unwanted multiplicative factor of N
-            for (int i = 0; i < N; i++) {
-                data[currentIndex + i] /= N;
-            }
-            fftw_destroy_plan(ifftPlan);
-            
-            currentIndex += N;
-        }
 
-        fftw_free(outputFft);
+            FFT::execute(inversePlan);
+
+            memcpy(&data[currentIndex], timeBlock + taps - 1, sizeof(R) * count);
+        }
     }
 
 private:
-    int frequency, N;
-    std::vector<double> coefficients;
-    std::vector<double> complexCoefficients;
-    std::mutex& mtx;
+    int frequency, N, taps;
+    // New samples consumed by every transform
+    size_t step;
+    std::vector<T> history;
+    typename FFT::plan forwardPlan, inversePlan;
+    // Arrays the plans are created on
+    void* block;
+    typename FFT::complex* spectrum;
+    // Filter frequency response, scaled by 1 / N to compensate the unnormalized inverse transform
+    typename FFT::complex* response;
+
+    /**
+     * @brief Fill the time block with the history followed by the next input samples, zero padding
+     * the last partial block, and update the history for the next transform
+     *
+     * @return The number of input samples loaded
+     */
+    size_t loadBlock(DataBuffer<T>& data, size_t currentIndex) {
+        T* timeBlock = reinterpret_cast<T*>(block);
+        size_t count = std::min(step, data.size() - currentIndex);
+
+        memcpy(timeBlock, history.data(), sizeof(T) * (taps - 1));
+        memcpy(timeBlock + taps - 1, &data[currentIndex], sizeof(T) * count);
+        if (count < step) {
+            std::fill(timeBlock + taps - 1 + count, timeBlock + N, T{});
+        }
+        memcpy(history.data(), timeBlock + count, sizeof(T) * (taps - 1));
 
-    float logistic(float f, float k, float f0) {
-        return 1 - 1 / (1 + exp(-k * (f - f0)));
+        return count;
     }
 
-    void generateCoefficients(int sampleRate) {
-        float fftIndex = frequency * (float) N / sampleRate;
-        coefficients.resize(N);
-        for (int i = 0; i < N / 2; i++) {
-            coefficients[i] = logistic(i, 1.0f, fftIndex);
+    void generateResponse(int sampleRate) {
+        std::vector<double> h = FirDesign::lowPass(taps, frequency, sampleRate, 1.0 / N);
+        T* timeBlock = reinterpret_cast<T*>(block);
+        // The impulse response is real, for complex blocks it only fills the real parts
+        R* samples = reinterpret_cast<R*>(block);
+        size_t stride = sizeof(T) / sizeof(R);
+
+        std::fill(timeBlock, timeBlock + N, T{});
+        for (int i = 0; i < taps; i++) {
+            samples[i * stride] = h[i];
         }
+        FFT::execute(forwardPlan);
+        memcpy(response, spectrum, sizeof(typename FFT::complex) * spectrumSize());
     }
 
-    void generateComplexCoefficients(int sampleRate) {
-        float fftIndex = frequency * (float) N / sampleRate;
-        complexCoefficients.resize(N);
-        for (int i = 0; i < N / 2; i++) {
-            complexCoefficients[i] = logistic(i, 1.0f, fftIndex);
-        }
-        // We want this filter to be symmetrical with respect tp the negative frequencies.
-        for (int i = N / 2; i < N; i++)
-        {
-            complexCoefficients[i] = complexCoefficients[N - i - 1];
-        }
+    template<typename Type = T>
+    auto spectrumSize() const -> typename std::enable_if<is_complex_type<Type>::value, int>::type {
+        return N;
+    }
+
+    template<typename Type = T>
+    auto spectrumSize() const -> typename std::enable_if<!is_complex_type<Type>::value, int>::type {
+        return N / 2 + 1;
+    }
+
+    template<typename Type = T>
+    auto createPlans(unsigned flags) -> typename std::enable_if<is_complex_type<Type>::value>::type {
+        block = FFT::allocComplex(N);
+        spectrum = FFT::allocComplex(N);
+        response = FFT::allocComplex(N);
+        typename FFT::complex* timeBlock = reinterpret_cast<typename FFT::complex*>(block);
+        std::lock_guard<std::mutex> lock(FftPlanner::mutex());
+        forwardPlan = FFT::planDft(N, timeBlock, spectrum, FFTW_FORWARD, flags);
+        inversePlan = FFT::planDft(N, spectrum, timeBlock, FFTW_BACKWARD, flags);
     }
-};
\ No newline at end of file
+
+    template<typename Type = T>
+    auto createPlans(unsigned flags) -> typename std::enable_if<!is_complex_type<Type>::value>::type {
+        block = FFT::allocReal(N);
+        spectrum = FFT::allocComplex(N / 2 + 1);
+        response = FFT::allocComplex(N / 2 + 1);
+        R* timeBlock = reinterpret_cast<R*>(block);
+        std::lock_guard<std::mutex> lock(FftPlanner::mutex());
+        forwardPlan = FFT::planDftR2c(N, timeBlock, spectrum, flags);
+        inversePlan = FFT::planDftC2r(N, spectrum, timeBlock, flags);
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "Complex.h"
+
+/**
+ * @brief Numerically controlled oscillator shifting complex samples in frequency.
+ * The samples are multiplied by `exp(j * phase)`, with the phase advancing by a fixed step per
+ * sample and kept across buffers, so consecutive buffers are shifted as one continuous stream.
+ * The oscillator runs as `LANES` independent phasor recurrences, one per sample of a group,
+ * each advanced by `LANES` steps at once: the loop has no dependency between the samples of a
+ * group and the compiler vectorizes it. The phasors are seeded again from the exact phase every
+ * `CHUNK` samples, so the rounding errors of the recurrence do not accumulate
+ * @tparam R The real type of the samples
+ */
+template <typename R>
+class Nco
+{
+public:
+    /**
+     * @brief Construct a new Nco object
+     *
+     * @param frequency Frequency of the oscillator, negative to shift the samples down
+     * @param sampleRate Sample rate of the shifted samples
+     */
+    Nco(double frequency = 0, double sampleRate = 1)
+    {
+        setFrequency(frequency, sampleRate);
+        reset();
+    }
+
+    /**
+     * @brief Change the frequency, the phase continues from its current value
+     */
+    void setFrequency(double frequency, double sampleRate)
+    {
+        step = remainder(2.0 * M_PI * frequency / sampleRate, 2.0 * M_PI);
+    }
+
+    /**
+     * @return The phase step, in radians per sample
+     */
+    double getStep() const
+    {
+        return step;
+    }
+
+    /**
+     * @brief Set the phase back to 0
+     */
+    void reset()
+    {
+        phase = 0;
+    }
+
+    /**
+     * @brief Set the phase to the one of the sample `position` of a stream shifted from its start
+     */
+    void seek(uint64_t position)
+    {
+        phase = (double)remainderl((long double)step * position, 2.0L * M_PI);
+    }
+
+    /**
+     * @brief Shift the samples in place
+     *
+     * @param samples The samples
+     * @param count The number of samples
+     */
+    void shift(BasicComplex<R> *samples, size_t count)
+    {
+        if (step == 0)
+        {
+            return;
+        }
+
+        for (size_t i = 0; i < count; i += CHUNK)
+        {
+            size_t n = std::min(CHUNK, count - i);
+            rotate(samples + i, n);
+            phase = remainder(phase + step * n, 2.0 * M_PI);
+        }
+    }
+
+private:
+    // Samples per group, a vector of floats with AVX
+    static constexpr size_t LANES = 8;
+    static constexpr size_t CHUNK = 1024;
+
+    double step;
+    double phase;
+
+    void rotate(BasicComplex<R> *__restrict samples, size_t count) const
+    {
+        R re[LANES], im[LANES];
+        for (size_t k = 0; k < LANES; k++)
+        {
+            re[k] = (R)cos(phase + step * k);
+            im[k] = (R)sin(phase + step * k);
+        }
+        const R stepRe = (R)cos(step * LANES);
+        const R stepIm = (R)sin(step * LANES);
+
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES)
+        {
+            for (size_t k = 0; k < LANES; k++)
+            {
+                R xr = samples[i + k].re, xi = samples[i + k].im;
+                samples[i + k].re = xr * re[k] - xi * im[k];
+                samples[i + k].im = xr * im[k] + xi * re[k];
+                R nextRe = re[k] * stepRe - im[k] * stepIm;
+                im[k] = re[k] * stepIm + im[k] * stepRe;
+                re[k] = nextRe;
+            }
+        }
+        for (size_t k = 0; i < count; i++, k++)
+        {
+            R xr = samples[i].re, xi = samples[i].im;
+            samples[i].re = xr * re[k] - xi * im[k];
+            samples[i].im = xr * im[k] + xi * re[k];
+        }
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "Complex.h"
+#include "FftPlanner.h"
+#include "FirDesign.h"
+
+/**
+ * @brief Streaming FFT polyphase filterbank, splitting a wideband stream in `channels` uniformly
+ * spaced channels, each one shifted to DC, low-pass filtered and decimated.
+ * Channel k is centered at `k * sampleRate / channels` (the upper half being the negative
+ * frequencies). For every output, the prototype low-pass filter is applied once per branch and a
+ * single inverse FFT of `channels` points gives all the channels, so the cost per input sample is
+ * the prototype length divided by the decimation plus one FFT every `decimation` samples, whatever
+ * the number of channels used. A decimation lower than the number of channels oversamples the
+ * channels, so the filter transitions do not alias.
+ * The last input samples are kept between calls, so consecutive buffers of any size are
+ * processed as a single continuous stream.
+ * @tparam R The real type of the complex samples
+ */
+template <typename R>
+class PolyphaseChannelizer
+{
+    typedef BasicComplex<R> T;
+    typedef Fftw<R> FFT;
+
+public:
+    PolyphaseChannelizer() = delete;
+    PolyphaseChannelizer(const PolyphaseChannelizer &) = delete;
+
+    /**
+     * @brief Construct a new PolyphaseChannelizer object
+     *
+     * @param channels Number of channels, the channel spacing is the sample rate divided by it
+     * @param decimation Decimation factor of the channels
+     * @param cutoff Cut-off frequency of the prototype low-pass filter (-6 dB point)
+     * @param transition Transition width of the prototype low-pass filter
+     * @param sampleRate Input sample rate
+     * @param rigor FFTW planning rigor
+     */
+    PolyphaseChannelizer(int channels, int decimation, int cutoff, int transition, int sampleRate,
+                         FftPlannerRigor rigor = FftPlannerRigor::Estimate)
+        : channels(channels), decimation(decimation),
+          tapsPerBranch(std::max(1, (int)ceil(5.5 * sampleRate / transition / channels))),
+          taps(channels * tapsPerBranch), coefficients(taps), history(taps - 1), seam(2 * (taps - 1))
+    {
+        assert(channels > 0 && decimation > 0);
+        std::vector<double> h = FirDesign::lowPass(taps, cutoff, sampleRate);
+        // Branch p holds the taps p, p + K, p + 2K, ...
+        for (int p = 0; p < channels; p++)
+        {
+            for (int q = 0; q < tapsPerBranch; q++)
+            {
+                coefficients[p * tapsPerBranch + q] = h[q * channels + p];
+            }
+        }
+
+        branches = FFT::allocComplex(channels);
+        spectrum = FFT::allocComplex(channels);
+        {
+            std::lock_guard<std::mutex> lock(FftPlanner::mutex());
+            plan = FFT::planDft(channels, branches, spectrum, FFTW_BACKWARD, static_cast<unsigned>(rigor));
+        }
+        reset();
+    }
+
+    ~PolyphaseChannelizer()
+    {
+        std::lock_guard<std::mutex> lock(FftPlanner::mutex());
+        FFT::destroyPlan(plan);
+        FFT::free(branches);
+        FFT::free(spectrum);
+    }
+
+    /**
+     * @brief Clear the filter history, the next buffer is processed as the start of a new stream
+     */
+    void reset()
+    {
+        std::fill(history.begin(), history.end(), T{});
+        nextOutput = 0;
+        streamOffset = 0;
+    }
+
+    int getChannels() const
+    {
+        return channels;
+    }
+
+    int getDecimation() const
+    {
+        return decimation;
+    }
+
+    /**
+     * @brief Number of samples produced per channel by the next call to `channelize` with `inputSize` samples
+     */
+    size_t outputSize(size_t inputSize) const
+    {
+        return nextOutput < inputSize ? (inputSize - nextOutput + decimation - 1) / decimation : 0;
+    }
+
+    /**
+     * @brief Split `count` input samples in the channels
+     *
+     * @param input The input samples
+     * @param count The number of input samples
+     * @param outputs For every channel, the buffer receiving its `outputSize(count)` samples,
+     * or `nullptr` if the channel is not used
+     */
+    void channelize(const T *input, size_t count, T *const *outputs)
+    {
+        size_t h = taps - 1;
+        size_t seamSize = h + std::min(h, count);
+
+        // Windows that start inside the history are read from the history joined with the first input samples
+        memcpy(seam.data(), history.data(), sizeof(T) * h);
+        memcpy(seam.data() + h, input, sizeof(T) * (seamSize - h));
+
+        size_t index = nextOutput;
+        size_t output = 0;
+        for (; index < count; index += decimation, output++)
+        {
+            const T *window = index < h ? seam.data() + index : input + index - h;
+            filterBranches(window, (int)((streamOffset + index) % channels));
+            FFT::execute(plan);
+
+            const T *result = reinterpret_cast<const T *>(spectrum);
+            for (int k = 0; k < channels; k++)
+            {
+                if (outputs[k] != nullptr)
+                {
+                    outputs[k][output] = result[k];
+                }
+            }
+        }
+        nextOutput = index - count;
+        streamOffset = (streamOffset + count) % channels;
+
+        if (count >= h)
+        {
+            memcpy(history.data(), input + count - h, sizeof(T) * h);
+        }
+        else
+        {
+            memcpy(history.data(), seam.data() + count, sizeof(T) * h);
+        }
+    }
+
+private:
+    int channels, decimation, tapsPerBranch, taps;
+    std::vector<R> coefficients;
+    std::vector<T> history;
+    // History followed by the first input samples of the current buffer
+    std::vector<T> seam;
+    // Index, relative to the next buffer, of the next input sample ending an output window
+    size_t nextOutput;
+    // Index in the stream of the first sample of the next buffer, modulo the number of channels
+    size_t streamOffset;
+    typename FFT::complex *branches, *spectrum;
+    typename FFT::plan plan;
+
+    /**
+     * @brief Filter the window with every branch of the prototype, into the FFT input
+     *
+     * @param window The `taps` input samples ending at the sample n
+     * @param rotation n modulo the number of channels
+     */
+    void filterBranches(const T *window, int rotation)
+    {
+        T *fftInput = reinterpret_cast<T *>(branches);
+        // Newest sample of the window
+        const T *newest = window + taps - 1;
+        for (int p = 0; p < channels; p++)
+        {
+            const R *c = coefficients.data() + p * tapsPerBranch;
+            const T *x = newest - p;
+            T acc{};
+            for (int q = 0; q < tapsPerBranch; q++)
+            {
+                acc += x[-(ptrdiff_t)q * channels] * c[q];
+            }
+            // Rotating the branches by n brings every channel to DC at the output time:
+            // the FFT input p' is the branch (p' + n) modulo K
+            fftInput[(p + channels - rotation) % channels] = acc;
+        }
+    }
+};
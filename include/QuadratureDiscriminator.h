@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdlib.h>
+#include <math.h>
+#include <limits>
+#include <algorithm>
+#include "Complex.h"
+
+/**
+ * @brief Formula used to compute the phase difference between consecutive samples
+ */
+enum class DiscriminatorMode
+{
+    // (re * dIm - im * dRe) / |z|^2, the sine of the phase difference
+    CrossProduct,
+    // Polynomial atan2 of z[n] * conj(z[n - 1]), the phase difference itself (error below 2.1e-6 rad)
+    FastAtan2
+};
+
+/**
+ * @brief FM quadrature discriminator over contiguous complex samples.
+ * The loops have no dependency between iterations and no branches, so the compiler vectorizes
+ * them. The last sample of every buffer is kept, so the first output of the next buffer is
+ * computed against it and no output is lost at the block boundaries
+ * @tparam R The real type of the samples
+ */
+template <typename R>
+class QuadratureDiscriminator
+{
+public:
+    QuadratureDiscriminator(DiscriminatorMode mode = DiscriminatorMode::CrossProduct)
+        : mode(mode)
+    {
+        reset();
+    }
+
+    /**
+     * @brief Forget the last sample, the next buffer is processed as the start of a new stream
+     */
+    void reset()
+    {
+        previous = BasicComplex<R>{0, 0};
+    }
+
+    DiscriminatorMode getMode() const
+    {
+        return mode;
+    }
+
+    /**
+     * @brief Compute the instantaneous frequency, in radians per sample
+     *
+     * @param input The complex samples
+     * @param count The number of samples
+     * @param output The `count` demodulated samples
+     */
+    void demodulate(const BasicComplex<R> *input, size_t count, R *output)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (mode == DiscriminatorMode::CrossProduct)
+        {
+            output[0] = crossProduct(input[0], previous);
+            crossProductKernel(input, count, output);
+        }
+        else
+        {
+            output[0] = phaseDifference(input[0], previous);
+            phaseDifferenceKernel(input, count, output);
+        }
+
+        previous = input[count - 1];
+    }
+
+private:
+    DiscriminatorMode mode;
+    BasicComplex<R> previous;
+
+    static void crossProductKernel(const BasicComplex<R> *__restrict input, size_t count, R *__restrict output)
+    {
+        for (size_t i = 1; i < count; i++)
+        {
+            output[i] = crossProduct(input[i], input[i - 1]);
+        }
+    }
+
+    static void phaseDifferenceKernel(const BasicComplex<R> *__restrict input, size_t count, R *__restrict output)
+    {
+        for (size_t i = 1; i < count; i++)
+        {
+            output[i] = phaseDifference(input[i], input[i - 1]);
+        }
+    }
+
+    static inline R crossProduct(const BasicComplex<R> &current, const BasicComplex<R> &last)
+    {
+        R num = current.re * (current.im - last.im) - current.im * (current.re - last.re);
+        // The smallest normal number keeps a zero sample from producing a NaN without branching
+        R den = sqr(current.re) + sqr(current.im) + std::numeric_limits<R>::min();
+        return num / den;
+    }
+
+    static inline R phaseDifference(const BasicComplex<R> &current, const BasicComplex<R> &last)
+    {
+        // z[n] * conj(z[n - 1])
+        R x = current.re * last.re + current.im * last.im;
+        R y = current.im * last.re - current.re * last.im;
+        return fastAtan2(y, x);
+    }
+
+    static inline R fastAtan2(R y, R x)
+    {
+        R ax = std::abs(x), ay = std::abs(y);
+        R mx = std::max(ax, ay), mn = std::min(ax, ay);
+        R a = mn / (mx + std::numeric_limits<R>::min());
+        R s = a * a;
+        // Minimax polynomial of atan on [0, 1]
+        R r = a * ((R)0.99997726 + s * ((R)-0.33262347 + s * ((R)0.19354346 +
+                   s * ((R)-0.11643287 + s * ((R)0.05265332 + s * (R)-0.01172120)))));
+        // The octant corrections are blended arithmetically: with the default trapping math the
+        // compiler does not vectorize conditional floating point selections
+        R swapped = ay > ax ? 1 : 0;
+        r += swapped * ((R)M_PI_2 - 2 * r);
+        R negative = x < 0 ? 1 : 0;
+        r += negative * ((R)M_PI - 2 * r);
+        return std::copysign(r, y);
+    }
+};
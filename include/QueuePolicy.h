@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief What a bounded stage queue does with a new block when it is full
+ */
+enum class OverflowPolicy
+{
+    // Wait until the consumer makes room
+    Block,
+    // Drop the oldest queued block, the queue always holds the most recent data
+    DropOldest,
+    // Drop the new block
+    DropNewest
+};
+
+/**
+ * @brief Overload counters of a stage queue
+ */
+struct QueueStats
+{
+    // Blocks dropped because the queue was full
+    uint64_t dropped = 0;
+    // Blocks whose producer had to wait because the queue was full
+    uint64_t blocked = 0;
+};
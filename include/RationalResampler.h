@@ -0,0 +1,274 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "Complex.h"
+#include "DataBuffer.h"
+#include "FirDesign.h"
+
+/**
+ * @brief Streaming polyphase resampler by the rational factor L / M.
+ * The input is conceptually upsampled by L, low-pass filtered and decimated by M, but only the
+ * output samples are computed: each one is the dot product of one of the L filter phases with
+ * the last input samples. The phase coefficients and the phase sequence are precomputed, so the
+ * conversion between any pair of integer rates is exact.
+ * The last input samples are kept between calls, so consecutive buffers of any size are
+ * processed as a single continuous stream. Alternatively `resampleAt` processes a block at any
+ * position of the stream without touching that state, so several threads can share the resampler.
+ * @tparam T The data type (`Complex`, `ComplexF`, `double` or `float`)
+ */
+template <typename T>
+class RationalResampler
+{
+    typedef typename real_type<T>::type R;
+
+public:
+    RationalResampler() = delete;
+    RationalResampler(const RationalResampler &) = delete;
+
+    /**
+     * @brief Construct a new RationalResampler object
+     *
+     * @param inputRate Input sample rate
+     * @param outputRate Output sample rate
+     * @param cutoff Cut-off frequency of the anti-aliasing filter (-6 dB point)
+     * @param transition Transition width of the anti-aliasing filter
+     * @param gain Gain applied to the output
+     */
+    RationalResampler(int inputRate, int outputRate, int cutoff, int transition, double gain = 1.0)
+        : interpolation(outputRate / std::gcd(inputRate, outputRate)),
+          decimation(inputRate / std::gcd(inputRate, outputRate)),
+          tapsPerPhase(tapsPerPhaseFor(inputRate, transition)),
+          coefficients(interpolation * tapsPerPhase), nextPhase(interpolation), inputAdvance(interpolation),
+          history(tapsPerPhase - 1), seam(2 * (tapsPerPhase - 1))
+    {
+        assert(inputRate > 0 && outputRate > 0);
+        int taps = interpolation * tapsPerPhase;
+        // The prototype runs at the upsampled rate, where the zero stuffing divides the signal by L
+        std::vector<double> h = FirDesign::lowPass(taps, cutoff, (double)inputRate * interpolation, gain * interpolation);
+
+        // Phase p holds the taps p, p + L, p + 2L, ... reversed, so every output is a forward dot product over the input
+        for (int p = 0; p < interpolation; p++)
+        {
+            for (int k = 0; k < tapsPerPhase; k++)
+            {
+                coefficients[p * tapsPerPhase + tapsPerPhase - 1 - k] = h[p + k * interpolation];
+            }
+            nextPhase[p] = (p + decimation) % interpolation;
+            inputAdvance[p] = (p + decimation) / interpolation;
+        }
+        reset();
+    }
+
+    /**
+     * @brief Clear the filter history, the next buffer is processed as the start of a new stream
+     */
+    void reset()
+    {
+        std::fill(history.begin(), history.end(), T{});
+        nextInput = 0;
+        phase = 0;
+    }
+
+    int getInterpolation() const
+    {
+        return interpolation;
+    }
+
+    int getDecimation() const
+    {
+        return decimation;
+    }
+
+    int getTapsPerPhase() const
+    {
+        return tapsPerPhase;
+    }
+
+    /**
+     * @brief Number of input samples preceding a block that its outputs depend on
+     */
+    size_t getHistorySize() const
+    {
+        return tapsPerPhase - 1;
+    }
+
+    /**
+     * @brief Number of output samples produced by the next call to `resample` with `inputSize` samples
+     */
+    size_t outputSize(size_t inputSize) const
+    {
+        // Outputs n are produced while (nextInput * L + phase + n * M) / L < inputSize
+        int64_t remaining = (int64_t)inputSize * interpolation - ((int64_t)nextInput * interpolation + phase);
+        return remaining > 0 ? (size_t)((remaining + decimation - 1) / decimation) : 0;
+    }
+
+    /**
+     * @brief Resample `count` input samples
+     *
+     * @param input The input samples
+     * @param count The number of input samples
+     * @param output The output, `outputSize(count)` samples are written
+     */
+    void resample(const T *input, size_t count, T *output)
+    {
+        size_t h = tapsPerPhase - 1;
+        size_t seamSize = h + std::min(h, count);
+
+        // Windows that start inside the history are read from the history joined with the first input samples
+        memcpy(seam.data(), history.data(), sizeof(T) * h);
+        memcpy(seam.data() + h, input, sizeof(T) * (seamSize - h));
+
+        size_t index = nextInput;
+        int p = phase;
+        for (; index < count && index < h; index += inputAdvance[p], p = nextPhase[p])
+        {
+            *output++ = dot(seam.data() + index, p);
+        }
+        for (; index < count; index += inputAdvance[p], p = nextPhase[p])
+        {
+            *output++ = dot(input + index - h, p);
+        }
+        nextInput = index - count;
+        phase = p;
+
+        if (count >= h)
+        {
+            memcpy(history.data(), input + count - h, sizeof(T) * h);
+        }
+        else
+        {
+            memcpy(history.data(), seam.data() + count, sizeof(T) * h);
+        }
+    }
+
+    /**
+     * @brief Resample a buffer
+     *
+     * @param data The input buffer
+     * @param pool Pool the output is taken from, or `nullptr` to allocate it on the heap
+     * @return The resampled buffer
+     */
+    DataBuffer<T> resample(const DataBuffer<T> &data, BufferPool *pool = nullptr)
+    {
+        DataBuffer<T> output(outputSize(data.size()), pool);
+        resample(data.get(), data.size(), output.get());
+        return output;
+    }
+
+    /**
+     * @brief Number of output samples produced by `resampleAt` for a block of `inputSize` samples
+     * starting at the input sample `position` of the stream
+     */
+    size_t outputSizeAt(uint64_t position, size_t inputSize) const
+    {
+        size_t index;
+        int p;
+        startAt(position, index, p);
+        int64_t remaining = (int64_t)inputSize * interpolation - ((int64_t)index * interpolation + p);
+        return remaining > 0 ? (size_t)((remaining + decimation - 1) / decimation) : 0;
+    }
+
+    /**
+     * @brief Index in the output stream of the first output at or after the input sample `position`,
+     * which is also the number of outputs of the samples before it
+     */
+    uint64_t outputIndexAt(uint64_t position) const
+    {
+        uint64_t offset = position % decimation;
+        return position / decimation * interpolation + (offset * interpolation + decimation - 1) / decimation;
+    }
+
+    /**
+     * @brief Last input sample whose `outputIndexAt` is at most `index`
+     */
+    uint64_t inputPositionAt(uint64_t index) const
+    {
+        return index / interpolation * decimation + index % interpolation * decimation / interpolation;
+    }
+
+    /**
+     * @brief Resample a block of the stream without using or changing the state of the resampler.
+     * The outputs are the ones `resample` would produce for these input samples, if the stream had
+     * been resampled from its start. This function is thread safe
+     *
+     * @param position Index in the stream of the first input sample
+     * @param input The input samples, preceded in memory by the `getHistorySize()` samples of the stream before them
+     * @param count The number of input samples
+     * @param output The output, `outputSizeAt(position, count)` samples are written
+     */
+    void resampleAt(uint64_t position, const T *input, size_t count, T *output) const
+    {
+        size_t h = tapsPerPhase - 1;
+        size_t index;
+        int p;
+        startAt(position, index, p);
+        for (; index < count; index += inputAdvance[p], p = nextPhase[p])
+        {
+            *output++ = dot(input + index - h, p);
+        }
+    }
+
+    /**
+     * @brief Number of input samples each output is computed from, for the given filter transition width
+     */
+    static int tapsPerPhaseFor(int inputRate, int transition)
+    {
+        // Transition width of the Blackman window is about 5.5 / taps of the sample rate
+        return std::max(1, (int)ceil(5.5 * inputRate / transition));
+    }
+
+private:
+    int interpolation, decimation, tapsPerPhase;
+    std::vector<R> coefficients;
+    // Phase following each phase and input samples to advance when moving to it
+    std::vector<int> nextPhase;
+    std::vector<size_t> inputAdvance;
+    std::vector<T> history;
+    // History followed by the first input samples of the current buffer
+    std::vector<T> seam;
+    // Index, relative to the next buffer, of the newest input sample of the next output window
+    size_t nextInput;
+    // Filter phase of the next output
+    int phase;
+
+    /**
+     * @brief Index of the input sample of the first output at or after `position`, and the phase of that output
+     */
+    void startAt(uint64_t position, size_t &index, int &p) const
+    {
+        // Output n sits at n * M on the upsampled axis. The sequence repeats every M input
+        // samples, so only the position within the period matters and nothing overflows
+        uint64_t offset = position % decimation;
+        uint64_t n = (offset * interpolation + decimation - 1) / decimation;
+        uint64_t upsampled = n * decimation;
+        index = upsampled / interpolation - offset;
+        p = upsampled % interpolation;
+    }
+
+    inline T dot(const T *window, int p) const
+    {
+        // Independent accumulators break the dependency chain between the additions
+        T acc0{}, acc1{}, acc2{}, acc3{};
+        const R *c = coefficients.data() + p * tapsPerPhase;
+        int i = 0;
+        for (; i + 4 <= tapsPerPhase; i += 4)
+        {
+            acc0 += window[i] * c[i];
+            acc1 += window[i + 1] * c[i + 1];
+            acc2 += window[i + 2] * c[i + 2];
+            acc3 += window[i + 3] * c[i + 3];
+        }
+        for (; i < tapsPerPhase; i++)
+        {
+            acc0 += window[i] * c[i];
+        }
+        return (acc0 + acc1) + (acc2 + acc3);
+    }
+};
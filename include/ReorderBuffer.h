@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief Puts back in sequence the blocks completed out of order by the workers of a stage.
+ * Every block is pushed with its sequence number, and the blocks are released to the release
+ * function in the order of the sequence numbers, starting from 0, without gaps. The release
+ * function is called by the thread that completes the sequence, under the lock of the buffer,
+ * so the releases never overlap and the next stage sees a single producer
+ * @tparam T The block type, it must be move constructible
+ */
+template <typename T>
+class ReorderBuffer
+{
+    typedef void (*ReleaseFunction)(T &, void *);
+
+public:
+    ReorderBuffer(const ReorderBuffer &) = delete;
+
+    /**
+     * @brief Construct a new ReorderBuffer object
+     *
+     * @param release Function receiving the blocks in order
+     * @param argument The argument passed to the release function
+     * @param capacity Initial number of blocks that can wait for a missing one, it grows when needed
+     */
+    ReorderBuffer(ReleaseFunction release, void *argument, size_t capacity = 32)
+        : release(release), releaseArg(argument), slots(std::max<size_t>(capacity, 1)), next(0)
+    {
+    }
+
+    /**
+     * @brief Add a completed block, and release it with the blocks that were waiting for it
+     *
+     * @param sequence Sequence number of the block
+     * @param block The block
+     */
+    void push(uint64_t sequence, T &&block)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        while (sequence - next >= slots.size())
+        {
+            grow();
+        }
+        slots[sequence % slots.size()].emplace(std::move(block));
+
+        for (std::optional<T> *slot = &slots[next % slots.size()]; slot->has_value(); slot = &slots[next % slots.size()])
+        {
+            T ready(std::move(**slot));
+            slot->reset();
+            next++;
+            release(ready, releaseArg);
+        }
+    }
+
+private:
+    ReleaseFunction release;
+    void *releaseArg;
+    std::mutex mtx;
+    // Block of sequence number s is at s modulo the size
+    std::vector<std::optional<T>> slots;
+    // Sequence number of the next block to release
+    uint64_t next;
+
+    void grow()
+    {
+        std::vector<std::optional<T>> larger(slots.size() * 2);
+        for (uint64_t s = next; s < next + slots.size(); s++)
+        {
+            std::optional<T> &slot = slots[s % slots.size()];
+            if (slot.has_value())
+            {
+                larger[s % larger.size()].emplace(std::move(*slot));
+                slot.reset();
+            }
+        }
+        slots.swap(larger);
+    }
+};
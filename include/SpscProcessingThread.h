@@ -0,0 +1,277 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include "SpscRing.h"
+#include "QueuePolicy.h"
+#include "ThreadConfig.h"
+#include "TaskScheduler.h"
+
+/**
+ * @brief Single data processing thread fed through a lock-free `SpscRing`.
+ * It has the interface of `DataProcessingThreadPool` with one thread, but `process` must always
+ * be called from the same thread: this is the transport between two pipeline stages, where the
+ * producer is the thread of the previous stage. When the ring is full the producer waits for the
+ * consumer, which propagates the back pressure to the previous stage: the overflow policy of the
+ * pipeline is applied by the queue at its input.
+ * With a scheduler, the blocks are processed by tasks of the scheduler, one at a time and in order
+ *
+ * @tparam T The data type
+ */
+template <typename T>
+class SpscProcessingThread
+{
+    typedef void (*ExecutorFunction)(T &, void *);
+    typedef void (*DiscontinuityFunction)(void *);
+
+public:
+    SpscProcessingThread(const SpscProcessingThread &) = delete;
+
+    /**
+     * @brief Construct a new Spsc Processing Thread object
+     *
+     * @param executor The executor function that will process the data
+     * @param argument The argument passed to the executor
+     * @param discontinuity Called before the executor when the block does not follow the previous
+     * one, so the stream state can be reset. Can be `nullptr`
+     * @param queueSize Capacity of the ring, rounded up to a power of two
+     * @param spinCount Number of polls of the ring before a waiting thread parks
+     * @param threadConfig Placement, scheduling and name of the thread
+     * @param threadIndex Index of the thread in its stage, for its name
+     * @param stageThreads Number of threads of the stage
+     * @param scheduler Shared scheduler running the blocks as tasks, one at a time, instead of the
+     * thread. Can be `nullptr`
+     */
+    SpscProcessingThread(ExecutorFunction executor, void *argument, DiscontinuityFunction discontinuity = nullptr,
+                         size_t queueSize = 32, unsigned spinCount = SpscRing<Entry>::defaultSpinCount(),
+                         const ThreadConfig &threadConfig = ThreadConfig(), size_t threadIndex = 0,
+                         size_t stageThreads = 1, TaskScheduler *scheduler = nullptr)
+        : executor(executor), discontinuity(discontinuity), executorArg(argument), scheduler(scheduler),
+          ring(queueSize, spinCount), threadConfigApplied(true)
+    {
+        if (scheduler == nullptr)
+        {
+            threadConfigApplied = threadConfig.start(thread, &SpscProcessingThread::innerExecutor, this, threadIndex,
+                                                     stageThreads);
+        }
+    }
+
+    ~SpscProcessingThread()
+    {
+        // The pending data is dropped with the ring
+        running.store(false);
+        ring.close();
+        if (scheduler == nullptr)
+        {
+            pthread_join(thread, NULL);
+        }
+        // The tasks already submitted find the thread stopped
+        while (tasks.load(std::memory_order_acquire) > 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Copy the data into the ring for being processed by the thread
+     *
+     * @param data The data to add
+     * @param discontinuity The data does not follow the previous one
+     */
+    void process(const T &data, bool discontinuity = false)
+    {
+        enqueue(Entry{T(data), discontinuity});
+    }
+
+    /**
+     * @brief Move the data into the ring for being processed by the thread
+     *
+     * @param data The data to add
+     * @param discontinuity The data does not follow the previous one
+     */
+    void process(T &&data, bool discontinuity = false)
+    {
+        enqueue(Entry{std::move(data), discontinuity});
+    }
+
+    /**
+     * Drop the data pushed so far and not yet processed. Unlike `process`, it can be called from any thread
+     */
+    void clear()
+    {
+        discardBefore.store(ring.pushed(), std::memory_order_release);
+    }
+
+    /**
+     * @return The overload counters of the ring, which never drops data
+     */
+    QueueStats getStats() const
+    {
+        QueueStats stats;
+        stats.blocked = blocked.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /**
+     * @return false if the thread configuration could not be fully applied
+     */
+    bool isThreadConfigApplied() const
+    {
+        return threadConfigApplied;
+    }
+
+    /**
+     * @return The number of blocks waiting in the ring
+     */
+    size_t getQueueSize() const
+    {
+        return ring.size();
+    }
+
+    static void *innerExecutor(void *arguments)
+    {
+        SpscProcessingThread *_this = reinterpret_cast<SpscProcessingThread *>(arguments);
+        while (_this->running.load(std::memory_order_relaxed))
+        {
+            std::optional<Entry> entry = _this->ring.pop();
+            if (!entry.has_value())
+            {
+                break;
+            }
+            _this->consume(*entry);
+        }
+
+        return NULL;
+    }
+
+    /**
+     * @brief Process the blocks of the ring on a worker of the scheduler, a batch at a time so the
+     * other tasks of the scheduler get their turn
+     */
+    static void taskExecutor(void *arguments)
+    {
+        SpscProcessingThread *_this = reinterpret_cast<SpscProcessingThread *>(arguments);
+        if (!_this->running.load(std::memory_order_relaxed))
+        {
+            _this->tasks.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        // Otherwise a blocked producer is consuming in place of the task, which tries again later
+        if (!_this->consuming.exchange(true, std::memory_order_acquire))
+        {
+            size_t processed = 0;
+            for (std::optional<Entry> entry; processed < TASK_BATCH_SIZE && (entry = _this->ring.tryPop()).has_value(); processed++)
+            {
+                _this->consume(*entry);
+            }
+
+            if (processed < TASK_BATCH_SIZE)
+            {
+                // The ring is empty: the producer submits a task for its next block, unless it has
+                // pushed it before seeing the flag cleared
+                _this->scheduled.store(false, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool pending = _this->ring.pushed() != _this->popped && !_this->scheduled.exchange(true);
+                _this->consuming.store(false, std::memory_order_release);
+                if (!pending)
+                {
+                    _this->tasks.fetch_sub(1, std::memory_order_release);
+                    return;
+                }
+            }
+            else
+            {
+                _this->consuming.store(false, std::memory_order_release);
+            }
+        }
+        _this->scheduler->submit(&SpscProcessingThread::taskExecutor, _this);
+    }
+
+private:
+    // Blocks processed by a task before it lets the other tasks of the scheduler run
+    static constexpr size_t TASK_BATCH_SIZE = 8;
+
+    struct Entry
+    {
+        T data;
+        // Blocks have been dropped between this block and the previous one
+        bool discontinuity;
+    };
+
+    ExecutorFunction executor;
+    DiscontinuityFunction discontinuity;
+    void *executorArg;
+    TaskScheduler *scheduler;
+    SpscRing<Entry> ring;
+    std::atomic<uint64_t> discardBefore{0};
+    std::atomic<uint64_t> blocked{0};
+    std::atomic<bool> running{true};
+    pthread_t thread;
+    bool threadConfigApplied;
+    // Consumer state: number of blocks popped from the ring, and whether the last ones were discarded
+    uint64_t popped = 0;
+    bool discarded = false;
+    // With a scheduler: a task has been submitted for the blocks in the ring, the ring is being
+    // consumed, and the number of tasks to wait for before the destruction
+    std::atomic<bool> scheduled{false}, consuming{false};
+    std::atomic<size_t> tasks{0};
+
+    void enqueue(Entry &&entry)
+    {
+        if (!ring.tryPush(std::move(entry)))
+        {
+            blocked.fetch_add(1, std::memory_order_relaxed);
+            if (scheduler == nullptr || !scheduler->isWorkerThread())
+            {
+                ring.push(std::move(entry));
+            }
+            else
+            {
+                // A worker of the scheduler can not sleep, the task it waits for could be queued behind
+                // it: it consumes a block itself when the task is not running, and yields otherwise
+                while (!ring.tryPush(std::move(entry)) && running.load(std::memory_order_relaxed))
+                {
+                    if (!consuming.exchange(true, std::memory_order_acquire))
+                    {
+                        std::optional<Entry> oldest = ring.tryPop();
+                        if (oldest.has_value())
+                        {
+                            consume(*oldest);
+                        }
+                        consuming.store(false, std::memory_order_release);
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+
+        if (scheduler != nullptr && !scheduled.exchange(true))
+        {
+            tasks.fetch_add(1, std::memory_order_relaxed);
+            scheduler->submit(&SpscProcessingThread::taskExecutor, this);
+        }
+    }
+
+    /**
+     * @brief Process a block popped from the ring, unless it has been cleared
+     */
+    void consume(Entry &entry)
+    {
+        if (popped++ < discardBefore.load(std::memory_order_acquire))
+        {
+            discarded = true;
+            return;
+        }
+        if ((entry.discontinuity || discarded) && discontinuity != nullptr)
+        {
+            discontinuity(executorArg);
+        }
+        discarded = false;
+        executor(entry.data, executorArg);
+    }
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Bounded lock-free ring between exactly one producer thread and one consumer thread.
+ * Pushing and popping only touch the two position counters, each on its own cache line.
+ * A side that has to wait, the consumer on an empty ring or the producer on a full one, spins
+ * for a while and then parks on a condition variable. The other side only takes the lock to
+ * wake it up when it is parked, so a busy stream never locks and never notifies
+ * @tparam T The element type, it must be move constructible
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    SpscRing(const SpscRing &) = delete;
+
+    /**
+     * @brief Construct a new SpscRing object
+     *
+     * @param capacity Number of elements, rounded up to a power of two
+     * @param spinCount Number of polls before a waiting side parks, 0 to park immediately
+     */
+    SpscRing(size_t capacity, unsigned spinCount = defaultSpinCount())
+        : slots(roundUpPowerOfTwo(capacity)), mask(slots.size() - 1), spinCount(spinCount)
+    {
+    }
+
+    size_t capacity() const
+    {
+        return slots.size();
+    }
+
+    /**
+     * @brief Number of polls before parking: spinning only pays off when the other side runs on another core
+     */
+    static unsigned defaultSpinCount()
+    {
+        return std::thread::hardware_concurrency() > 1 ? 2048 : 0;
+    }
+
+    /**
+     * @brief Number of elements in the ring, exact only when read by the producer or the consumer
+     */
+    size_t size() const
+    {
+        return (size_t)(tail.value.load(std::memory_order_relaxed) - head.value.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Number of elements pushed since the construction, can be read from any thread
+     */
+    uint64_t pushed() const
+    {
+        return tail.value.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Add an element if the ring is not full. Producer thread only
+     *
+     * @return false if the ring is full, the element is left untouched
+     */
+    bool tryPush(T &&item)
+    {
+        uint64_t t = tail.value.load(std::memory_order_relaxed);
+        if (t - head.value.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+        slots[t & mask].emplace(std::move(item));
+        tail.value.store(t + 1, std::memory_order_seq_cst);
+        wake(consumerParked);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest element if the ring is not empty. Consumer thread only
+     */
+    std::optional<T> tryPop()
+    {
+        uint64_t h = head.value.load(std::memory_order_relaxed);
+        if (h == tail.value.load(std::memory_order_acquire))
+        {
+            return std::nullopt;
+        }
+        std::optional<T> item(std::move(slots[h & mask]));
+        slots[h & mask].reset();
+        head.value.store(h + 1, std::memory_order_seq_cst);
+        wake(producerParked);
+        return item;
+    }
+
+    /**
+     * @brief Add an element, waiting for a free slot. Producer thread only
+     *
+     * @return false if the ring has been closed, the element is dropped
+     */
+    bool push(T &&item)
+    {
+        return waitFor(producerParked, [&]()
+                       { return tryPush(std::move(item)); },
+                       [&]()
+                       { return tail.value.load(std::memory_order_relaxed) - head.value.load(std::memory_order_seq_cst) < slots.size(); });
+    }
+
+    /**
+     * @brief Remove the oldest element, waiting for one. Consumer thread only
+     *
+     * @return The element, or nothing if the ring has been closed
+     */
+    std::optional<T> pop()
+    {
+        std::optional<T> item;
+        waitFor(consumerParked, [&]()
+                { item = tryPop();
+                  return item.has_value(); },
+                [&]()
+                { return head.value.load(std::memory_order_relaxed) != tail.value.load(std::memory_order_seq_cst); });
+        return item;
+    }
+
+    /**
+     * @brief Wake up and release both sides, the waiting calls return without an element
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed.store(true, std::memory_order_seq_cst);
+        cv.notify_all();
+    }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    struct alignas(CACHE_LINE) Counter
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    // Index of the next element to pop, written by the consumer
+    Counter head;
+    // Index of the next element to push, written by the producer
+    Counter tail;
+    std::vector<std::optional<T>> slots;
+    size_t mask;
+    unsigned spinCount;
+
+    std::atomic<bool> consumerParked{false}, producerParked{false}, closed{false};
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    /**
+     * @brief Retry `attempt` until it succeeds, spinning first and then parking until `available`
+     */
+    template <typename F, typename A>
+    bool waitFor(std::atomic<bool> &parked, F attempt, A available)
+    {
+        for (unsigned i = 0; i < spinCount; i++)
+        {
+            if (attempt())
+            {
+                return true;
+            }
+            if (closed.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            relax();
+        }
+
+        while (!attempt())
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            // Announce the parking before checking again: the other side either sees the flag
+            // after its update, or the update is seen by this check
+            parked.store(true, std::memory_order_seq_cst);
+            cv.wait(lock, [&]()
+                    { return closed.load(std::memory_order_seq_cst) || available(); });
+            parked.store(false, std::memory_order_relaxed);
+            if (closed.load(std::memory_order_seq_cst))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void wake(std::atomic<bool> &parked)
+    {
+        if (parked.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cv.notify_all();
+        }
+    }
+
+    static inline void relax()
+    {
+#if defined(__SSE2__)
+        _mm_pause();
+#endif
+    }
+
+    static size_t roundUpPowerOfTwo(size_t n)
+    {
+        size_t size = 1;
+        while (size < n)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "Complex.h"
+#include "RationalResampler.h"
+
+/**
+ * @brief FM stereo decoder, from the demodulated multiplex signal to interleaved left and right audio.
+ * A PLL locks on the 19 kHz pilot and the 38 kHz carrier of the L-R subchannel is regenerated
+ * from its phasor (sin 2x = 2 sin x cos x), so no trigonometric function is evaluated per sample.
+ * As in ITU-R BS.450, the pilot is sin(x) and the subcarrier sin(2x), in phase with it.
+ * L+R and L-R are packed in the real and imaginary parts of complex samples, and a single
+ * `RationalResampler` pass low-pass filters and resamples both to the audio rate.
+ * The decoder falls back to mono when the pilot is missing, blending between the two over a block
+ * @tparam R The real type of the samples
+ */
+template <typename R>
+class StereoDecoder
+{
+public:
+    StereoDecoder(const StereoDecoder &) = delete;
+
+    /**
+     * @brief Construct a new StereoDecoder object
+     *
+     * @param sampleRate Sample rate of the multiplex signal
+     * @param audioSampleRate Output audio sample rate
+     * @param gain Gain applied to the output
+     */
+    StereoDecoder(int sampleRate, int audioSampleRate, double gain = 1.0)
+        : resampler(sampleRate, audioSampleRate,
+                    std::min(AUDIO_CUTOFF, (audioSampleRate - AUDIO_TRANSITION) / 2), AUDIO_TRANSITION, gain),
+          pilotStep(2.0 * M_PI * PILOT_FREQUENCY / sampleRate),
+          pilotLevel(M_PI * PILOT_DEVIATION / sampleRate),
+          loopBandwidth(2.0 * M_PI * LOOP_BANDWIDTH / sampleRate),
+          maxCorrection(2.0 * M_PI * MAX_PILOT_ERROR / sampleRate),
+          lockAlpha(1.0 / (LOCK_TIME_CONSTANT * sampleRate))
+    {
+        reset();
+    }
+
+    /**
+     * @brief Unlock the PLL and clear the filter history
+     */
+    void reset()
+    {
+        carrierRe = 1;
+        carrierIm = 0;
+        integrator = 0;
+        pilotAmplitude = 0;
+        blend = 0;
+        stereo.store(false, std::memory_order_relaxed);
+        resampler.reset();
+    }
+
+    /**
+     * @return true if the pilot is received and the output is stereo. This function is thread safe
+     */
+    bool isStereo() const
+    {
+        return stereo.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Number of stereo frames produced by the next call to `decode` with `inputSize` samples
+     */
+    size_t outputSize(size_t inputSize) const
+    {
+        return resampler.outputSize(inputSize);
+    }
+
+    /**
+     * @brief Decode `count` multiplex samples
+     *
+     * @param mpx The multiplex signal, the output of the FM discriminator
+     * @param count The number of samples
+     * @param output The interleaved left and right samples, `2 * outputSize(count)` values are written
+     */
+    void decode(const R *mpx, size_t count, R *output)
+    {
+        size_t frames = resampler.outputSize(count);
+        if (channels.size() < count)
+        {
+            channels.resize(count);
+        }
+        if (decimated.size() < frames)
+        {
+            decimated.resize(frames);
+        }
+
+        demultiplex(mpx, count, channels.data());
+        resampler.resample(channels.data(), count, decimated.data());
+
+        // The stereo information fades in or out along the block when the pilot appears or disappears
+        R target = stereo.load(std::memory_order_relaxed) ? 1 : 0;
+        R from = blend;
+        R slope = frames > 0 ? (target - from) / frames : 0;
+        for (size_t i = 0; i < frames; i++)
+        {
+            R difference = decimated[i].im * (from + slope * i);
+            output[2 * i] = decimated[i].re + difference;
+            output[2 * i + 1] = decimated[i].re - difference;
+        }
+        blend = target;
+    }
+
+private:
+    static constexpr int PILOT_FREQUENCY = 19000;
+    // The pilot deviates the carrier by 9% of the 75 kHz of full modulation
+    static constexpr int PILOT_DEVIATION = 6750;
+    static constexpr int AUDIO_CUTOFF = 16000;
+    static constexpr int AUDIO_TRANSITION = 4000;
+    // Natural frequency of the loop, and the largest distance of the pilot from 19 kHz it tracks
+    static constexpr double LOOP_BANDWIDTH = 10.0;
+    static constexpr double MAX_PILOT_ERROR = 20.0;
+    // Time constant of the pilot amplitude estimate, in seconds
+    static constexpr double LOCK_TIME_CONSTANT = 0.05;
+    // Pilot amplitude, relative to the expected one, above which the stereo is enabled and below which it is disabled
+    static constexpr double LOCK_THRESHOLD = 0.5;
+    static constexpr double UNLOCK_THRESHOLD = 0.25;
+
+    RationalResampler<BasicComplex<R>> resampler;
+    // L+R and L-R at the multiplex rate, and at the audio rate
+    std::vector<BasicComplex<R>> channels, decimated;
+
+    double pilotStep;
+    // Expected in-phase output of the phase detector, half the pilot amplitude in radians per sample
+    double pilotLevel;
+    double loopBandwidth, maxCorrection, lockAlpha;
+    // Phasor locked on the pilot, whose imaginary part follows sin(x)
+    double carrierRe, carrierIm;
+    double integrator;
+    // Average in-phase product of the pilot and the phasor
+    double pilotAmplitude;
+    R blend;
+    std::atomic<bool> stereo;
+
+    void demultiplex(const R *mpx, size_t count, BasicComplex<R> *out)
+    {
+        const double stepRe = cos(pilotStep), stepIm = sin(pilotStep);
+        // Second order loop with a damping factor of 0.707, on the phase detector normalized by the expected pilot level
+        const double kp = 2.0 * 0.707 * loopBandwidth / pilotLevel;
+        const double ki = loopBandwidth * loopBandwidth / pilotLevel;
+        double re = carrierRe, im = carrierIm, integ = integrator, amplitude = pilotAmplitude;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            double x = mpx[i];
+            // The L-R subchannel is double sideband on sin(2x), the second harmonic of the pilot sin(x)
+            out[i] = BasicComplex<R>{(R)x, (R)(x * 2.0 * (2.0 * re * im))};
+
+            // The pilot times cos(x), in quadrature, gives the phase error, times sin(x) the pilot amplitude
+            double error = x * re;
+            amplitude += (x * im - amplitude) * lockAlpha;
+            integ = std::max(-maxCorrection, std::min(maxCorrection, integ + ki * error));
+            double correction = std::max(-maxCorrection, std::min(maxCorrection, integ + kp * error));
+
+            // Advance by the pilot step and the small correction angle, then bring the phasor back to the unit circle
+            double nextRe = re * stepRe - im * stepIm;
+            double nextIm = re * stepIm + im * stepRe;
+            re = nextRe - correction * nextIm;
+            im = nextIm + correction * nextRe;
+            double norm = 1.5 - 0.5 * (re * re + im * im);
+            re *= norm;
+            im *= norm;
+        }
+
+        carrierRe = re;
+        carrierIm = im;
+        integrator = integ;
+        pilotAmplitude = amplitude;
+
+        bool locked = stereo.load(std::memory_order_relaxed);
+        if (!locked && amplitude > LOCK_THRESHOLD * pilotLevel)
+        {
+            stereo.store(true, std::memory_order_relaxed);
+        }
+        else if (locked && amplitude < UNLOCK_THRESHOLD * pilotLevel)
+        {
+            stereo.store(false, std::memory_order_relaxed);
+        }
+    }
+};
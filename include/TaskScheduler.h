@@ -0,0 +1,240 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "ThreadConfig.h"
+
+/**
+ * @brief Work-stealing scheduler running short tasks on a fixed set of threads.
+ * Every worker has its own deque: the tasks submitted by a worker go to the back of its deque and
+ * it runs them last in first out, so the block a stage has just produced is processed by the next
+ * stage while it is still in the cache. An idle worker steals the oldest task of another worker,
+ * and parks when there is none. Tasks submitted by other threads are spread over the workers.
+ * The stages of many pipelines can share one scheduler sized to the cores instead of running
+ * threads of their own, see `FmDemodulatorOptions::scheduler`
+ */
+class TaskScheduler
+{
+public:
+    typedef void (*TaskFunction)(void *);
+
+    TaskScheduler(const TaskScheduler &) = delete;
+
+    /**
+     * @brief Construct a new Task Scheduler object
+     *
+     * @param threads Number of workers, 0 for one per hardware thread
+     * @param threadConfig Placement, scheduling and name of the workers
+     */
+    TaskScheduler(size_t threads = 0, const ThreadConfig &threadConfig = ThreadConfig("fm-worker"))
+        : spinSweeps(std::thread::hardware_concurrency() > 1 ? SPIN_SWEEPS : 0)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < threads; i++)
+        {
+            workers.emplace_back(new Worker());
+        }
+        for (size_t i = 0; i < threads; i++)
+        {
+            WorkerStart *start = new WorkerStart{this, i};
+            threadConfigApplied &= threadConfig.start(workers[i]->thread, &TaskScheduler::workerExecutor, start, i, threads);
+        }
+    }
+
+    /**
+     * @brief Stop the workers. The tasks not started yet are dropped, so the users of the scheduler
+     * must be destroyed before it
+     */
+    ~TaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            running.store(false);
+            parkCv.notify_all();
+        }
+        for (std::unique_ptr<Worker> &worker : workers)
+        {
+            pthread_join(worker->thread, NULL);
+        }
+    }
+
+    /**
+     * @brief The scheduler shared by the whole process, with one worker per hardware thread.
+     * It is created by the first call
+     */
+    static TaskScheduler &shared()
+    {
+        static TaskScheduler scheduler;
+        return scheduler;
+    }
+
+    /**
+     * @brief Run a task on one of the workers. This function is thread safe
+     *
+     * @param function The task
+     * @param arg The argument passed to the task
+     */
+    void submit(TaskFunction function, void *arg)
+    {
+        // A worker keeps its own tasks, the other threads deal them out
+        size_t index = currentWorker().scheduler == this ? currentWorker().index
+                                                         : nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        // Counted first, so `pending` never goes below the tasks in the deques
+        pending.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mtx);
+            workers[index]->tasks.push_back(Task{function, arg});
+        }
+
+        // The parking worker announces itself before checking `pending` again, so one of the two sees the other
+        if (sleepers.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            parkCv.notify_one();
+        }
+    }
+
+    /**
+     * @return true if the calling thread is one of the workers. A worker waiting for another task
+     * must not block: that task could be queued behind it
+     */
+    bool isWorkerThread() const
+    {
+        return currentWorker().scheduler == this;
+    }
+
+    size_t getThreads() const
+    {
+        return workers.size();
+    }
+
+    /**
+     * @return false if the thread configuration could not be fully applied
+     */
+    bool isThreadConfigApplied() const
+    {
+        return threadConfigApplied;
+    }
+
+private:
+    // Sweeps over the deques before parking: spinning only pays off when the tasks come from another core
+    static constexpr unsigned SPIN_SWEEPS = 64;
+
+    struct Task
+    {
+        TaskFunction function;
+        void *arg;
+    };
+
+    struct Worker
+    {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+        pthread_t thread;
+    };
+
+    struct WorkerStart
+    {
+        TaskScheduler *scheduler;
+        size_t index;
+    };
+
+    // Scheduler and index of the worker running on the thread
+    struct CurrentWorker
+    {
+        TaskScheduler *scheduler = nullptr;
+        size_t index = 0;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    unsigned spinSweeps;
+    std::atomic<size_t> nextWorker{0};
+    // Tasks submitted and not taken yet
+    std::atomic<size_t> pending{0};
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> running{true};
+    std::mutex parkMtx;
+    std::condition_variable parkCv;
+    bool threadConfigApplied = true;
+
+    static CurrentWorker &currentWorker()
+    {
+        static thread_local CurrentWorker worker;
+        return worker;
+    }
+
+    /**
+     * @brief Take the newest task of the worker `index`, or else steal the oldest task of another one
+     */
+    bool take(size_t index, Task &task)
+    {
+        if (pending.load(std::memory_order_relaxed) == 0)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            Worker &worker = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mtx);
+            if (!worker.tasks.empty())
+            {
+                if (i == 0)
+                {
+                    task = worker.tasks.back();
+                    worker.tasks.pop_back();
+                }
+                else
+                {
+                    task = worker.tasks.front();
+                    worker.tasks.pop_front();
+                }
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void *workerExecutor(void *arguments)
+    {
+        std::unique_ptr<WorkerStart> start(reinterpret_cast<WorkerStart *>(arguments));
+        TaskScheduler *_this = start->scheduler;
+        currentWorker().scheduler = _this;
+        currentWorker().index = start->index;
+
+        Task task;
+        while (_this->running.load(std::memory_order_relaxed))
+        {
+            bool found = false;
+            for (unsigned i = 0; i <= _this->spinSweeps && !found; i++)
+            {
+                found = _this->take(start->index, task);
+            }
+            if (found)
+            {
+                task.function(task.arg);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_this->parkMtx);
+            _this->sleepers.fetch_add(1, std::memory_order_seq_cst);
+            _this->parkCv.wait(lock, [&]()
+                               { return !_this->running.load() || _this->pending.load(std::memory_order_seq_cst) > 0; });
+            _this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        currentWorker().scheduler = nullptr;
+        return NULL;
+    }
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// Set to 1 by the FMDEMOD_TELEMETRY CMake option. When 0 the pipeline reads no clock and updates no counter
+#ifndef FMDEMOD_TELEMETRY
+#define FMDEMOD_TELEMETRY 0
+#endif
+
+/**
+ * @brief Summary of a latency distribution, in nanoseconds. The percentiles are the upper bounds
+ * of their histogram buckets, within 1/16 of the value
+ */
+struct LatencyStats
+{
+    uint64_t count = 0;
+    double mean = 0;
+    uint64_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+};
+
+/**
+ * @brief Log-linear histogram of durations in nanoseconds, recorded without locks.
+ * Every power of two is split in 16 buckets, so the relative error is bounded at any scale,
+ * from nanoseconds to hours, with a fixed array of counters. Any thread can record while
+ * another one takes a snapshot
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        for (std::atomic<uint64_t> &bucket : buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t ns)
+    {
+        buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (ns > current && !max.compare_exchange_weak(current, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    LatencyStats snapshot() const
+    {
+        LatencyStats stats;
+        uint64_t counts[BUCKETS];
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i] = buckets[i].load(std::memory_order_relaxed);
+            stats.count += counts[i];
+        }
+        if (stats.count == 0)
+        {
+            return stats;
+        }
+
+        stats.mean = (double)sum.load(std::memory_order_relaxed) / count.load(std::memory_order_relaxed);
+        stats.max = max.load(std::memory_order_relaxed);
+        stats.p50 = percentile(counts, stats.count, 0.50);
+        stats.p90 = percentile(counts, stats.count, 0.90);
+        stats.p99 = percentile(counts, stats.count, 0.99);
+        return stats;
+    }
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // Values up to 2^48 ns, about 3 days, the larger ones go in the last bucket
+    static constexpr int MAX_BITS = 48;
+    static constexpr int BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count{0}, sum{0}, max{0};
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS)
+        {
+            return (int)ns;
+        }
+        int bits = 63 - __builtin_clzll(ns);
+        int shift = bits - SUB_BUCKET_BITS;
+        int index = (shift + 1) * SUB_BUCKETS + (int)((ns >> shift) & (SUB_BUCKETS - 1));
+        return std::min(index, BUCKETS - 1);
+    }
+
+    /**
+     * @brief Largest value falling in the bucket
+     */
+    static uint64_t upperBound(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return (uint64_t)bucket;
+        }
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t lower = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+    uint64_t percentile(const uint64_t *counts, uint64_t total, double fraction) const
+    {
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(fraction * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return std::min(upperBound(i), max.load(std::memory_order_relaxed));
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief Activity of a pipeline stage
+ */
+struct StageStats
+{
+    uint64_t blocks = 0;
+    // Samples entering the stage
+    uint64_t samples = 0;
+    // Time spent processing a block
+    LatencyStats service;
+    // Fraction of the time since the pipeline started that the stage threads were busy, divided
+    // by the number of threads. A stage approaching 1 is falling behind the real time
+    double utilization = 0;
+    // Blocks waiting in the queue of the stage when the snapshot was taken
+    size_t queueDepth = 0;
+};
+
+/**
+ * @brief Counters and histograms of a pipeline stage, updated by its threads without locks
+ */
+class StageTelemetry
+{
+public:
+    void record(uint64_t samples, uint64_t ns)
+    {
+        blocks.fetch_add(1, std::memory_order_relaxed);
+        this->samples.fetch_add(samples, std::memory_order_relaxed);
+        busy.fetch_add(ns, std::memory_order_relaxed);
+        service.record(ns);
+    }
+
+    /**
+     * @param elapsed Time since the pipeline started, in nanoseconds
+     * @param threads Number of threads running the stage
+     */
+    StageStats snapshot(uint64_t elapsed, int threads) const
+    {
+        StageStats stats;
+        stats.blocks = blocks.load(std::memory_order_relaxed);
+        stats.samples = samples.load(std::memory_order_relaxed);
+        stats.service = service.snapshot();
+        stats.utilization = elapsed > 0 ? (double)busy.load(std::memory_order_relaxed) / elapsed / threads : 0;
+        return stats;
+    }
+
+private:
+    std::atomic<uint64_t> blocks{0}, samples{0}, busy{0};
+    LatencyHistogram service;
+};
+
+namespace Telemetry
+{
+    inline uint64_t now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+#if FMDEMOD_TELEMETRY
+
+/**
+ * @brief Time a block entered the pipeline, carried along with it to measure the end-to-end latency
+ */
+struct TelemetryTimestamp
+{
+    uint64_t ns = Telemetry::now();
+};
+
+/**
+ * @brief Records the service time of a block into its stage when it goes out of scope
+ */
+class StageTimer
+{
+public:
+    StageTimer(StageTelemetry &stage, uint64_t samples)
+        : stage(stage), samples(samples), begin(Telemetry::now())
+    {
+    }
+
+    ~StageTimer()
+    {
+        stage.record(samples, Telemetry::now() - begin);
+    }
+
+private:
+    StageTelemetry &stage;
+    uint64_t samples;
+    uint64_t begin;
+};
+
+#else
+
+// Nothing is measured, the timestamp carried by the blocks is empty
+struct TelemetryTimestamp
+{
+};
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <system_error>
+
+/**
+ * @brief Placement, scheduling and name of the threads of a pipeline stage.
+ * The default configuration leaves the threads to the scheduler. Pinning a stage to the cores of
+ * one NUMA node also keeps its buffers on that node: the buffer pools hand the memory of a block
+ * back to the stage that produces it, and Linux places a page on the node of the thread that
+ * touches it first
+ */
+struct ThreadConfig
+{
+    ThreadConfig(const std::string &name = std::string()) : name(name)
+    {
+    }
+
+    // CPUs the threads of the stage may run on, or empty to let them run on any CPU
+    std::vector<int> cpus;
+    // SCHED_FIFO priority, from 1 to 99, or 0 to keep the default policy. It needs the
+    // CAP_SYS_NICE capability or an RLIMIT_RTPRIO limit at least as high
+    int realtimePriority = 0;
+    // Name shown by top, perf and the debuggers, followed by the index of the thread when the
+    // stage has several. Linux truncates it to 15 characters
+    std::string name;
+
+    /**
+     * @brief Start a thread of the stage with the configuration. The CPUs and the priority are set
+     * on the attributes of the thread, so it never runs elsewhere: the memory it touches first is
+     * on the node of its CPUs
+     *
+     * @param thread Receives the thread
+     * @param routine The function run by the thread
+     * @param arg The argument passed to the function
+     * @param index Index of the thread in the stage
+     * @param threads Number of threads of the stage
+     * @return false if a setting could not be applied, typically the priority without the
+     * permission. The thread is started anyway, with the other settings
+     * @throw std::system_error if the thread can not be created even without the settings
+     */
+    bool start(pthread_t &thread, void *(*routine)(void *), void *arg, size_t index, size_t threads) const
+    {
+        bool applied = true;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        if (!cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus)
+            {
+                CPU_SET(cpu, &set);
+            }
+            applied &= pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0;
+        }
+
+        if (realtimePriority > 0)
+        {
+            sched_param param;
+            param.sched_priority = realtimePriority;
+            applied &= pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) == 0 &&
+                       pthread_attr_setschedpolicy(&attr, SCHED_FIFO) == 0 &&
+                       pthread_attr_setschedparam(&attr, &param) == 0;
+        }
+
+        int result = pthread_create(&thread, &attr, routine, arg);
+        if (result != 0 && realtimePriority > 0)
+        {
+            // Without the permission the thread can not be created with the priority, keep its placement
+            applied = false;
+            pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+            result = pthread_create(&thread, &attr, routine, arg);
+        }
+        if (result != 0)
+        {
+            applied = false;
+            result = pthread_create(&thread, NULL, routine, arg);
+        }
+        pthread_attr_destroy(&attr);
+        if (result != 0)
+        {
+            // No thread at all, typically out of resources: fail as `std::thread` does
+            throw std::system_error(result, std::generic_category(), "pthread_create");
+        }
+
+        if (!name.empty())
+        {
+            std::string threadName = threads > 1 ? name + "-" + std::to_string(index) : name;
+            // Longer names are rejected rather than truncated
+            threadName.resize(std::min<size_t>(threadName.size(), MAX_NAME_LENGTH));
+            applied &= pthread_setname_np(thread, threadName.c_str()) == 0;
+        }
+
+        return applied;
+    }
+
+private:
+    static constexpr size_t MAX_NAME_LENGTH = 15;
+};
@@ -1,117 +1,492 @@
 #include "FmDemodulator.h"
 
 #include <utility>
+#include <numeric>
+#include <string.h>
 
 #define DurationMs(end, begin) std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
 
-FmDemodulator::FmDemodulator(std::function<void(const DataBuffer<int16_t> &)>  demodCallback, int sampleRate,
-                             int audioSampleRate, float gain)
-    : demodCallback(std::move(demodCallback)),
-      sampleRate(sampleRate),
-      audioSampleRate(audioSampleRate),
-      digitalGain(gain),
-      filterMtx(),
-      lowPass(filterMtx, 100000, 8192, sampleRate),
-      audioLowPass(filterMtx, 20000, 4096, FM_DOWNSAMPLED),
-      sdrTransformPool(&FmDemodulator::transformExecutor, this),
-      filterPool(&FmDemodulator::filterExecutor, this),
-      demodPool(&FmDemodulator::demodExecutor, this)
+template <typename R>
+BasicFmDemodulator<R>::BasicFmDemodulator(std::function<void(const DataBuffer<int16_t> &)> demodCallback, int sampleRate,
+                                          int audioSampleRate, float gain, const FmDemodulatorOptions &options)
+    : stereo(options.stereo),
+      latestConfig(makeConfiguration(FmDemodulatorSettings{sampleRate, audioSampleRate, gain, options.frequencyOffset},
+                                     nullptr)),
+      pendingConfig(nullptr),
+      transformConfig(latestConfig),
+      demodConfig(latestConfig),
+      iqConverter(options.removeDcOffset, options.iqScale),
+      nco(-options.frequencyOffset, sampleRate),
+      ncoFrequencyOffset(options.frequencyOffset),
+      ncoSampleRate(sampleRate),
+      iqHistory(latestConfig->iqResampler->getHistorySize()),
+      nextSequence(0),
+      streamPosition(0),
+      latencyBudget(options.latencyBudget),
+      transformDiscontinuity(false),
+      discriminator(options.discriminator),
+      demodCallback(std::move(demodCallback)),
+      audioOutput(nullptr),
+      filterWorkers(options.filterWorkers),
+#if FMDEMOD_TELEMETRY
+      startTime(Telemetry::now()),
+#endif
+      demodPool(&BasicFmDemodulator::demodExecutor, this, &BasicFmDemodulator::demodDiscontinuityHandler, STAGE_QUEUE_SIZE,
+                SpscRing<DemodBlock>::defaultSpinCount(), options.demodThread, 0, 1, options.scheduler),
+      reorderBuffer(&BasicFmDemodulator::releaseExecutor, this),
+      filterPool(&BasicFmDemodulator::filterExecutor, this, OverflowPolicy::Block, nullptr, options.filterWorkers,
+                 options.filterThreads, options.scheduler),
+      sdrTransformPool(&BasicFmDemodulator::transformExecutor, this, options.overflowPolicy,
+                       &BasicFmDemodulator::transformDiscontinuityHandler, TRDPOOL_SZ, options.transformThread,
+                       options.scheduler)
 {
 }
 
-FmDemodulator::~FmDemodulator()
+template <typename R>
+BasicFmDemodulator<R>::BasicFmDemodulator(AudioRing &output, int sampleRate, int audioSampleRate, float gain,
+                                          const FmDemodulatorOptions &options)
+    : BasicFmDemodulator(nullptr, sampleRate, audioSampleRate, gain, options)
 {
+    // No block reaches the demod stage before the first call to `demodulate`
+    audioOutput = &output;
 }
 
-void FmDemodulator::demodulate(const DataBuffer<uint8_t> &buffer, size_t count)
+template <typename R>
+BasicFmDemodulator<R>::~BasicFmDemodulator()
 {
-    sdrTransformPool.process(DataBuffer<uint8_t>(buffer.get(), count));
+    // Exchanged in case the transform stage picks it up at the same time
+    delete pendingConfig.exchange(nullptr);
 }
 
-void FmDemodulator::demodulate(DataBuffer<uint8_t> &&buffer)
+template <typename R>
+void BasicFmDemodulator<R>::demodulate(const DataBuffer<uint8_t> &buffer, size_t count)
 {
-    sdrTransformPool.process(std::move(buffer));
+    sdrTransformPool.process(InputBlock{DataBuffer<uint8_t>(buffer.get(), count, &inputBuffers), TelemetryTimestamp{}});
 }
 
-void FmDemodulator::transformExecutor(DataBuffer<uint8_t> &data, void *arg)
+template <typename R>
+void BasicFmDemodulator<R>::demodulate(DataBuffer<uint8_t> &&buffer)
 {
-    FmDemodulator *_this = reinterpret_cast<FmDemodulator *>(arg);
+    sdrTransformPool.process(InputBlock{std::move(buffer), TelemetryTimestamp{}});
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::demodulate(uint8_t *data, size_t count, DataBuffer<uint8_t>::ReleaseFunction release, void *arg)
+{
+    sdrTransformPool.process(InputBlock{DataBuffer<uint8_t>(data, count, release, arg), TelemetryTimestamp{}});
+}
 
-    // Transform data by subtracting 128 (ADC middle point) and converting to std::complex
-    DataBuffer<Complex> tfData(data.size() / 2);
-    for (size_t i = 0; i < data.size(); i += 2)
+template <typename R>
+void BasicFmDemodulator<R>::transformExecutor(InputBlock &block, void *arg)
+{
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
+#if FMDEMOD_TELEMETRY
+    StageTimer timer(_this->transformTelemetry, block.data.size() / 2);
+#endif
+
+    // Switch to the configuration published since the previous block, if any
+    if (_this->pendingConfig.load(std::memory_order_relaxed) != nullptr)
     {
-        double re = (data[i] - 128.0);
-        double im = (data[i + 1] - 128.0);
-        tfData[i / 2] = {re, im};
+        std::shared_ptr<const Configuration> *pending = _this->pendingConfig.exchange(nullptr, std::memory_order_acquire);
+        if (pending != nullptr)
+        {
+            if ((*pending)->iqResampler != _this->transformConfig->iqResampler)
+            {
+                // The blocks already queued keep the previous resampler, the stream starts over with the new one
+                _this->iqHistory.assign((*pending)->iqResampler->getHistorySize(), Sample{});
+                _this->streamPosition = 0;
+                _this->transformDiscontinuity = true;
+            }
+            _this->transformConfig = std::move(*pending);
+            delete pending;
+        }
     }
 
-    _this->filterPool.process(tfData);
+    int sRate = _this->transformConfig->settings.sampleRate;
+    int offset = _this->transformConfig->settings.frequencyOffset;
+    if (offset != _this->ncoFrequencyOffset || sRate != _this->ncoSampleRate)
+    {
+        _this->nco.setFrequency(-offset, sRate);
+        _this->ncoFrequencyOffset = offset;
+        _this->ncoSampleRate = sRate;
+    }
+
+    // With a latency budget the block is split in slices that go through the next stages on their
+    // own, so the audio of the first slice comes out without waiting for the rest of the block
+    size_t h = _this->iqHistory.size();
+    size_t count = block.data.size() / 2;
+    size_t sliceSize = count;
+    if (_this->latencyBudget > 0)
+    {
+        sliceSize = std::max<size_t>(1, (size_t)(_this->latencyBudget * LATENCY_SLICE_FRACTION * sRate));
+    }
+
+    {
+        // Owning the input here gives it back as soon as it is converted, before waiting on the next stage
+        DataBuffer<uint8_t> input(std::move(block.data));
+        for (size_t i = 0; i < count; i += sliceSize)
+        {
+            // Transform data by subtracting 128 (ADC middle point), or the DC offset, converting to complex
+            // and shifting the station to DC. The slice starts with the last samples of the previous one,
+            // so the filter workers do not depend on each other
+            size_t n = std::min(sliceSize, count - i);
+            DataBuffer<Sample> tfData(h + n, &_this->iqBuffers);
+            memcpy(tfData.get(), _this->iqHistory.data(), sizeof(Sample) * h);
+            _this->iqConverter.convert(input.get() + 2 * i, n, tfData.get() + h, _this->nco);
+            memcpy(_this->iqHistory.data(), tfData.get() + n, sizeof(Sample) * h);
+
+            _this->slices.push_back(IqBlock{_this->nextSequence++, _this->streamPosition,
+                                            std::exchange(_this->transformDiscontinuity, false),
+                                            _this->transformConfig, std::move(tfData), block.received});
+            _this->streamPosition += n;
+        }
+    }
+
+    for (IqBlock &slice : _this->slices)
+    {
+        _this->filterPool.process(std::move(slice));
+    }
+    _this->slices.clear();
 }
 
-void FmDemodulator::filterExecutor(DataBuffer<Complex> &data, void *arg)
+template <typename R>
+void BasicFmDemodulator<R>::filterExecutor(IqBlock &block, void *arg)
 {
-    FmDemodulator *_this = reinterpret_cast<FmDemodulator *>(arg);
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
 
-    // Lowpass 100kHz
-    _this->lowPass.filter(data);
+    // Lowpass 100kHz and resample to the FM demodulation sample rate
+    const RationalResampler<Sample> &resampler = *block.config->iqResampler;
+    size_t h = resampler.getHistorySize();
+    size_t count = block.samples.size() - h;
+#if FMDEMOD_TELEMETRY
+    StageTimer timer(_this->filterTelemetry, count);
+#endif
+    DataBuffer<Sample> resampled(resampler.outputSizeAt(block.position, count), &_this->resampledBuffers);
+    resampler.resampleAt(block.position, block.samples.get() + h, count, resampled.get());
 
-    _this->demodPool.process(data);
+    _this->reorderBuffer.push(block.sequence, ResampledBlock{std::move(resampled), std::move(block.config),
+                                                             block.discontinuity, block.received});
 }
 
-void FmDemodulator::demodExecutor(DataBuffer<Complex> &data, void *arg)
+template <typename R>
+void BasicFmDemodulator<R>::releaseExecutor(ResampledBlock &block, void *arg)
 {
-    FmDemodulator *_this = reinterpret_cast<FmDemodulator *>(arg);
-
-    std::unique_lock<std::mutex> srLock(_this->sampleRateMtx);
-    int sRate = _this->sampleRate;
-    srLock.unlock();
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
+    _this->demodPool.process(DemodBlock{std::move(block.samples), std::move(block.config), block.received}, block.discontinuity);
+}
 
-    std::unique_lock<std::mutex> gainLock(_this->dGainMtx);
-    float dGain = _this->digitalGain;
-    gainLock.unlock();
+template <typename R>
+void BasicFmDemodulator<R>::demodExecutor(DemodBlock &block, void *arg)
+{
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
+#if FMDEMOD_TELEMETRY
+    {
+        StageTimer timer(_this->demodTelemetry, block.samples.size());
+        demodulateBlock(_this, block);
+    }
+    _this->endToEndLatency.record(Telemetry::now() - block.received.ns);
+#else
+    demodulateBlock(_this, block);
+#endif
+}
 
-    size_t downsampledSize = data.size() / (sRate / FM_DOWNSAMPLED);
-    size_t outputSize = (downsampledSize - 1) / (FM_DOWNSAMPLED / _this->audioSampleRate);
+template <typename R>
+void BasicFmDemodulator<R>::demodulateBlock(BasicFmDemodulator *_this, DemodBlock &block)
+{
+    if (block.config != _this->demodConfig)
+    {
+        // Kept for the discontinuity handler, which resets the filters of the last block
+        _this->demodConfig = block.config;
+    }
+    const Configuration &config = *block.config;
+    DataBuffer<Sample> &data = block.samples;
+    float dGain = config.settings.digitalGain;
 
-    DataBuffer<double> demodulatedBuffer(downsampledSize - 1);
-    DataBuffer<int16_t> audioBuffer(outputSize);
+    // The discriminator carries the last sample of the previous block, every sample produces an output
+    DataBuffer<R> demodulatedBuffer(data.size(), &_this->demodBuffers);
+    _this->discriminator.demodulate(data.get(), data.size(), demodulatedBuffer.get());
 
-    DownsampledBufferAccessor<Complex> dataDs(data, sRate, FM_DOWNSAMPLED);
-    for (size_t i = 1; i < dataDs.size(); i++)
+    if (config.stereoDecoder)
     {
-        demodulatedBuffer[i - 1] =
-            (dataDs[i].re * (dataDs[i].im - dataDs[i - 1].im) - dataDs[i].im * (dataDs[i].re - dataDs[i - 1].re)) / (sqr(dataDs[i].re) + sqr(dataDs[i].im));
+        // Recover L+R and L-R, lowpass both and resample them to the audio sample rate in one pass
+        size_t frames = config.stereoDecoder->outputSize(demodulatedBuffer.size());
+        DataBuffer<R> stereoDs(2 * frames, &_this->demodBuffers);
+        config.stereoDecoder->decode(demodulatedBuffer.get(), demodulatedBuffer.size(), stereoDs.get());
+
+        deliverAudio(_this, stereoDs.get(), stereoDs.size(), dGain);
+        return;
     }
 
-    // Lowpass 20kHz
-    _this->audioLowPass.filter(demodulatedBuffer);
+    // Lowpass 20kHz and resample to the audio sample rate
+    DataBuffer<R> demodDs = config.audioResampler->resample(demodulatedBuffer, &_this->demodBuffers);
+
+    deliverAudio(_this, demodDs.get(), demodDs.size(), dGain);
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::deliverAudio(BasicFmDemodulator *_this, const R *audio, size_t count, float gain)
+{
+    if (_this->audioOutput != nullptr)
+    {
+        // Written in place, in two parts when the block wraps around the end of the ring
+        int16_t *first, *second;
+        size_t firstSize;
+        if (!_this->audioOutput->beginWrite(count, first, firstSize, second))
+        {
+            return;
+        }
+        for (size_t i = 0; i < firstSize; i++)
+        {
+            first[i] = BasicFmDemodulator::coerceToInt16(audio[i] * gain);
+        }
+        for (size_t i = firstSize; i < count; i++)
+        {
+            second[i - firstSize] = BasicFmDemodulator::coerceToInt16(audio[i] * gain);
+        }
+        _this->audioOutput->endWrite(count);
+        return;
+    }
 
-    // Downsample to 44.1kHz sample rate
-    DownsampledBufferAccessor<double> demodDs(demodulatedBuffer, FM_DOWNSAMPLED, _this->audioSampleRate);
-    for (int i = 0; i < demodDs.size(); i++)
+    DataBuffer<int16_t> audioBuffer(count, &_this->demodBuffers);
+    for (size_t i = 0; i < count; i++)
     {
-        audioBuffer[i] = FmDemodulator::coerceToInt16(demodDs[i] * dGain);
+        audioBuffer[i] = BasicFmDemodulator::coerceToInt16(audio[i] * gain);
     }
 
     _this->demodCallback(audioBuffer);
 }
 
-void FmDemodulator::setSampleRate(int sampleRate) {
-    demodPool.clear();
-    std::lock_guard<std::mutex> lock(sampleRateMtx);
-    this->sampleRate = sampleRate;
+template <typename R>
+void BasicFmDemodulator<R>::transformDiscontinuityHandler(void *arg)
+{
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
+    // Start the resampler history over instead of joining two unrelated blocks through it
+    std::fill(_this->iqHistory.begin(), _this->iqHistory.end(), Sample{});
+    _this->transformDiscontinuity = true;
 }
 
-void FmDemodulator::setDigitalGain(float gain) {
-    std::lock_guard<std::mutex> lock(dGainMtx);
-    this->digitalGain = gain;
+template <typename R>
+void BasicFmDemodulator<R>::demodDiscontinuityHandler(void *arg)
+{
+    BasicFmDemodulator *_this = reinterpret_cast<BasicFmDemodulator *>(arg);
+    _this->discriminator.reset();
+    if (_this->demodConfig->audioResampler)
+    {
+        _this->demodConfig->audioResampler->reset();
+    }
+    if (_this->demodConfig->stereoDecoder)
+    {
+        _this->demodConfig->stereoDecoder->reset();
+    }
 }
 
-int FmDemodulator::getSampleRate() const {
-    return this->sampleRate;
+template <typename R>
+std::shared_ptr<const typename BasicFmDemodulator<R>::Configuration>
+BasicFmDemodulator<R>::makeConfiguration(const FmDemodulatorSettings &settings, const Configuration *previous) const
+{
+    std::shared_ptr<Configuration> config = std::make_shared<Configuration>();
+    config->settings = settings;
+    config->intermediateRate = chooseIntermediateRate(settings.sampleRate, settings.audioSampleRate);
+    const FmDemodulatorSettings *last = previous != nullptr ? &previous->settings : nullptr;
+    bool sameIntermediateRate = previous != nullptr && config->intermediateRate == previous->intermediateRate;
+
+    if (sameIntermediateRate && settings.sampleRate == last->sampleRate && settings.iqCutoff == last->iqCutoff)
+    {
+        config->iqResampler = previous->iqResampler;
+    }
+    else
+    {
+        config->iqResampler = std::make_shared<const RationalResampler<Sample>>(settings.sampleRate, config->intermediateRate,
+                                                                                settings.iqCutoff, IQ_TRANSITION);
+    }
+
+    // Sharing the audio filters carries their state over, new ones start from silence
+    if (sameIntermediateRate && settings.audioSampleRate == last->audioSampleRate && settings.audioCutoff == last->audioCutoff)
+    {
+        config->audioResampler = previous->audioResampler;
+        config->stereoDecoder = previous->stereoDecoder;
+    }
+    else
+    {
+        // The discriminator output scales with the intermediate rate
+        double gain = (double)config->intermediateRate / GAIN_REFERENCE_RATE;
+        if (stereo)
+        {
+            config->stereoDecoder = std::make_shared<StereoDecoder<R>>(config->intermediateRate, settings.audioSampleRate, gain);
+        }
+        else
+        {
+            config->audioResampler = std::make_shared<RationalResampler<R>>(
+                config->intermediateRate, settings.audioSampleRate,
+                std::min(settings.audioCutoff, (settings.audioSampleRate - AUDIO_TRANSITION) / 2), AUDIO_TRANSITION, gain);
+        }
+    }
+    return config;
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::publishConfiguration(const FmDemodulatorSettings &settings)
+{
+    latestConfig = makeConfiguration(settings, latestConfig.get());
+    // Replaces the configuration the transform stage has not picked up yet, if any
+    delete pendingConfig.exchange(new std::shared_ptr<const Configuration>(latestConfig), std::memory_order_release);
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::reconfigure(const FmDemodulatorSettings &settings) {
+    std::lock_guard<std::mutex> lock(configMtx);
+    publishConfiguration(settings);
+}
+
+template <typename R>
+FmDemodulatorSettings BasicFmDemodulator<R>::getSettings() const {
+    std::lock_guard<std::mutex> lock(configMtx);
+    return latestConfig->settings;
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::setSampleRate(int sampleRate) {
+    std::lock_guard<std::mutex> lock(configMtx);
+    FmDemodulatorSettings settings = latestConfig->settings;
+    settings.sampleRate = sampleRate;
+    publishConfiguration(settings);
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::setAudioSampleRate(int audioSampleRate) {
+    std::lock_guard<std::mutex> lock(configMtx);
+    FmDemodulatorSettings settings = latestConfig->settings;
+    settings.audioSampleRate = audioSampleRate;
+    publishConfiguration(settings);
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::setDigitalGain(float gain) {
+    std::lock_guard<std::mutex> lock(configMtx);
+    FmDemodulatorSettings settings = latestConfig->settings;
+    settings.digitalGain = gain;
+    publishConfiguration(settings);
+}
+
+template <typename R>
+void BasicFmDemodulator<R>::setFrequencyOffset(int offset) {
+    std::lock_guard<std::mutex> lock(configMtx);
+    FmDemodulatorSettings settings = latestConfig->settings;
+    settings.frequencyOffset = offset;
+    publishConfiguration(settings);
+}
+
+template <typename R>
+int BasicFmDemodulator<R>::getSampleRate() const {
+    return getSettings().sampleRate;
+}
+
+template <typename R>
+int BasicFmDemodulator<R>::getAudioSampleRate() const {
+    return getSettings().audioSampleRate;
+}
+
+template <typename R>
+float BasicFmDemodulator<R>::getDigitalGain() const {
+    return getSettings().digitalGain;
+}
+
+template <typename R>
+int BasicFmDemodulator<R>::getFrequencyOffset() const {
+    return getSettings().frequencyOffset;
+}
+
+template <typename R>
+int BasicFmDemodulator<R>::getIntermediateRate() const {
+    std::lock_guard<std::mutex> lock(configMtx);
+    return latestConfig->intermediateRate;
+}
+
+template <typename R>
+bool BasicFmDemodulator<R>::isStereo() const {
+    std::lock_guard<std::mutex> lock(configMtx);
+    return latestConfig->stereoDecoder && latestConfig->stereoDecoder->isStereo();
+}
+
+template <typename R>
+bool BasicFmDemodulator<R>::isThreadConfigApplied() const {
+    return sdrTransformPool.isThreadConfigApplied() && filterPool.isThreadConfigApplied() &&
+           demodPool.isThreadConfigApplied();
+}
+
+template <typename R>
+FmDemodulatorQueueStats BasicFmDemodulator<R>::getQueueStats() const {
+    FmDemodulatorQueueStats stats;
+    stats.input = sdrTransformPool.getStats();
+    stats.filter = filterPool.getStats();
+    stats.demod = demodPool.getStats();
+    return stats;
+}
+
+template <typename R>
+FmDemodulatorTelemetry BasicFmDemodulator<R>::getTelemetry() const {
+    FmDemodulatorTelemetry telemetry;
+#if FMDEMOD_TELEMETRY
+    uint64_t elapsed = Telemetry::now() - startTime;
+    telemetry.transform = transformTelemetry.snapshot(elapsed, TRDPOOL_SZ);
+    telemetry.filter = filterTelemetry.snapshot(elapsed, filterWorkers);
+    telemetry.demod = demodTelemetry.snapshot(elapsed, 1);
+    telemetry.endToEnd = endToEndLatency.snapshot();
+#endif
+    telemetry.transform.queueDepth = sdrTransformPool.getQueueSize();
+    telemetry.filter.queueDepth = filterPool.getQueueSize();
+    telemetry.demod.queueDepth = demodPool.getQueueSize();
+    return telemetry;
+}
+
+template <typename R>
+double BasicFmDemodulator<R>::getFilterDelay() const {
+    std::lock_guard<std::mutex> lock(configMtx);
+    int sampleRate = latestConfig->settings.sampleRate;
+    int intermediateRate = latestConfig->intermediateRate;
+    // Half the filter length of both resamplers, the stereo decoder filters with the audio transition too
+    return RationalResampler<Sample>::tapsPerPhaseFor(sampleRate, IQ_TRANSITION) / 2.0 / sampleRate +
+           RationalResampler<R>::tapsPerPhaseFor(intermediateRate, AUDIO_TRANSITION) / 2.0 / intermediateRate;
+}
+
+template <typename R>
+size_t BasicFmDemodulator<R>::inputBlockSize(double latencyBudget, int sampleRate) {
+    size_t bytes = 2 * (size_t)(latencyBudget * LATENCY_SLICE_FRACTION * sampleRate);
+    return std::max(USB_TRANSFER_SIZE, bytes / USB_TRANSFER_SIZE * USB_TRANSFER_SIZE);
+}
+
+template <typename R>
+int BasicFmDemodulator<R>::chooseIntermediateRate(int sampleRate, int audioSampleRate)
+{
+    int iqTaps = RationalResampler<Sample>::tapsPerPhaseFor(sampleRate, IQ_TRANSITION);
+    int bestRate = MIN_INTERMEDIATE_RATE;
+    double bestCost = std::numeric_limits<double>::max();
+    int64_t bestTableSize = std::numeric_limits<int64_t>::max();
+    bool bestFits = false;
+
+    for (int rate = MIN_INTERMEDIATE_RATE; rate <= MAX_INTERMEDIATE_RATE; rate++)
+    {
+        int audioTaps = RationalResampler<R>::tapsPerPhaseFor(rate, AUDIO_TRANSITION);
+        int64_t iqPhases = rate / std::gcd(sampleRate, rate);
+        int64_t audioPhases = audioSampleRate / std::gcd(rate, audioSampleRate);
+        int64_t tableSize = iqPhases * iqTaps + audioPhases * audioTaps;
+        bool fits = tableSize <= MAX_PHASE_TABLE_SIZE;
+
+        // A complex IQ output costs two real multiply-accumulates per tap, the discriminator about four per sample
+        double cost = (double)rate * (2.0 * iqTaps + 4.0) + (double)audioSampleRate * audioTaps;
+
+        // Fall back to the smallest phase tables if no rate fits
+        if (fits ? (!bestFits || cost < bestCost) : (!bestFits && tableSize < bestTableSize))
+        {
+            bestRate = rate;
+            bestCost = cost;
+            bestTableSize = tableSize;
+            bestFits = fits;
+        }
+    }
+
+    return bestRate;
 }
 
-float FmDemodulator::getDigitalGain() const {
-    return this->digitalGain;
-}
\ No newline at end of file
+template class BasicFmDemodulator<double>;
+template class BasicFmDemodulator<float>;
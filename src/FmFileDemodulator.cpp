@@ -0,0 +1,207 @@
+#include "FmFileDemodulator.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include "IqConverter.h"
+#include "Nco.h"
+#include "QuadratureDiscriminator.h"
+
+template <typename R>
+BasicFmFileDemodulator<R>::BasicFmFileDemodulator(int sampleRate, int audioSampleRate, float gain,
+                                                  const FmDemodulatorOptions &options, int threads, size_t chunkSize)
+    : sampleRate(sampleRate),
+      audioSampleRate(audioSampleRate),
+      intermediateRate(BasicFmDemodulator<R>::chooseIntermediateRate(sampleRate, audioSampleRate)),
+      digitalGain(gain),
+      options(options),
+      threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      chunkSize(std::max<size_t>(chunkSize, 1)),
+      iqResampler(sampleRate, intermediateRate, IQ_CUTOFF, IQ_TRANSITION),
+      audioResampler(intermediateRate, audioSampleRate,
+                     std::min(AUDIO_CUTOFF, (audioSampleRate - AUDIO_TRANSITION) / 2), AUDIO_TRANSITION,
+                     (double)intermediateRate / GAIN_REFERENCE_RATE)
+{
+}
+
+template <typename R>
+bool BasicFmFileDemodulator<R>::demodulateFile(const std::string &path, const DemodCallback &callback)
+{
+    if (options.stereo)
+    {
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    demodulate(reinterpret_cast<const uint8_t *>(data), size, callback);
+    munmap(data, size);
+    return true;
+}
+
+template <typename R>
+bool BasicFmFileDemodulator<R>::demodulate(const uint8_t *data, size_t size, const DemodCallback &callback)
+{
+    // The stereo decoder can not start in the middle of the recording, the chunks would be mono
+    if (options.stereo)
+    {
+        return false;
+    }
+
+    Job job;
+    job.owner = this;
+    job.data = data;
+    job.samples = size / 2;
+    job.chunks = (job.samples + chunkSize - 1) / chunkSize;
+    job.nextChunk = 0;
+    job.released = 0;
+    job.callback = &callback;
+    ReorderBuffer<DataBuffer<int16_t>> reorderBuffer(&BasicFmFileDemodulator::releaseExecutor, &job);
+    job.reorderBuffer = &reorderBuffer;
+
+    // The chunks are taken in order, at most `CHUNKS_AHEAD_PER_THREAD` per worker ahead of the oldest
+    // one not delivered, so the reorder buffer holds a bounded number of chunks even if a worker stalls
+    std::vector<pthread_t> workers(std::min<size_t>(threads, job.chunks));
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        pthread_create(&workers[i], nullptr, &BasicFmFileDemodulator::worker, &job);
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        pthread_join(workers[i], nullptr);
+    }
+    return true;
+}
+
+template <typename R>
+void *BasicFmFileDemodulator<R>::worker(void *arg)
+{
+    Job *job = reinterpret_cast<Job *>(arg);
+    size_t window = CHUNKS_AHEAD_PER_THREAD * (size_t)job->owner->threads;
+    while (true)
+    {
+        size_t chunk;
+        {
+            std::unique_lock<std::mutex> lock(job->mtx);
+            // The oldest chunk not delivered is being demodulated by another worker, never waiting here
+            job->cv.wait(lock, [&]()
+                         { return job->nextChunk == job->chunks || job->nextChunk - job->released < window; });
+            if (job->nextChunk == job->chunks)
+            {
+                break;
+            }
+            chunk = job->nextChunk++;
+        }
+        job->reorderBuffer->push(chunk, job->owner->demodulateChunk(job->data, job->samples, chunk));
+    }
+    return nullptr;
+}
+
+template <typename R>
+void BasicFmFileDemodulator<R>::releaseExecutor(DataBuffer<int16_t> &audio, void *arg)
+{
+    Job *job = reinterpret_cast<Job *>(arg);
+    (*job->callback)(audio);
+    {
+        std::lock_guard<std::mutex> lock(job->mtx);
+        job->released++;
+    }
+    job->cv.notify_all();
+}
+
+template <typename R>
+DataBuffer<int16_t> BasicFmFileDemodulator<R>::demodulateChunk(const uint8_t *data, size_t samples, size_t chunk)
+{
+    uint64_t begin = chunk * chunkSize;
+    uint64_t end = std::min<uint64_t>(begin + chunkSize, samples);
+    size_t h = iqResampler.getHistorySize();
+    size_t audioHistory = audioResampler.getHistorySize();
+
+    // The chunk owns the intermediate samples [first, last). It also demodulates the ones the audio
+    // resampler history needs, plus one for the discriminator, from the sample `warmUp`
+    uint64_t first = iqResampler.outputIndexAt(begin);
+    uint64_t last = iqResampler.outputIndexAt(end);
+    uint64_t warmUp = first > audioHistory + 1 ? first - audioHistory - 1 : 0;
+
+    // The IQ samples from `position` produce the intermediate samples from `warmUp` on, and the
+    // resampler history before them is zero before the start of the recording
+    uint64_t position = iqResampler.inputPositionAt(warmUp);
+    uint64_t start = position > h ? position - h : 0;
+    size_t lead = h - (size_t)(position - start);
+    DataBuffer<Sample> iq(h + (size_t)(end - position), &buffers);
+    std::fill(iq.get(), iq.get() + lead, Sample{});
+
+    IqConverter converter(options.removeDcOffset, options.iqScale);
+    Nco<R> nco(-options.frequencyOffset, sampleRate);
+    nco.seek(start);
+    converter.convert(data + 2 * start, (size_t)(end - start), iq.get() + lead, nco);
+
+    // Lowpass 100kHz and resample to the FM demodulation sample rate
+    uint64_t resampledIndex = iqResampler.outputIndexAt(position);
+    DataBuffer<Sample> resampled(iqResampler.outputSizeAt(position, (size_t)(end - position)), &buffers);
+    iqResampler.resampleAt(position, iq.get() + h, (size_t)(end - position), resampled.get());
+
+    // The audio resampler history is zero before the start of the recording
+    DataBuffer<R> demodulated(audioHistory + (size_t)(last - warmUp), &buffers);
+    std::fill(demodulated.get(), demodulated.get() + audioHistory, (R)0);
+    QuadratureDiscriminator<R> discriminator(options.discriminator);
+    discriminator.demodulate(resampled.get() + (warmUp - resampledIndex), (size_t)(last - warmUp),
+                             demodulated.get() + audioHistory);
+
+    // Lowpass 20kHz and resample to the audio sample rate
+    size_t count = (size_t)(last - first);
+    DataBuffer<R> demodDs(audioResampler.outputSizeAt(first, count), &buffers);
+    audioResampler.resampleAt(first, demodulated.get() + audioHistory + (first - warmUp), count, demodDs.get());
+
+    DataBuffer<int16_t> audioBuffer(demodDs.size());
+    for (size_t i = 0; i < demodDs.size(); i++)
+    {
+        audioBuffer[i] = coerceToInt16(demodDs[i] * digitalGain);
+    }
+    return audioBuffer;
+}
+
+template <typename R>
+int BasicFmFileDemodulator<R>::getIntermediateRate() const
+{
+    return intermediateRate;
+}
+
+template <typename R>
+int BasicFmFileDemodulator<R>::getThreads() const
+{
+    return threads;
+}
+
+template class BasicFmFileDemodulator<double>;
+template class BasicFmFileDemodulator<float>;
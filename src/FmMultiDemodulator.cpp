@@ -0,0 +1,261 @@
+#include "FmMultiDemodulator.h"
+
+#include <utility>
+#include <math.h>
+
+template <typename R>
+BasicFmMultiDemodulator<R>::Station::Station(BasicFmMultiDemodulator *owner, size_t index, int channel, double offset,
+                                             const FmDemodulatorOptions &options)
+    : owner(owner),
+      index(index),
+      channel(channel),
+      nco(-offset, owner->channelRate),
+      iqResampler(owner->channelRate, owner->intermediateRate, IQ_CUTOFF, IQ_TRANSITION),
+      discriminator(options.discriminator),
+      audioResampler(options.stereo ? nullptr
+                                    : new RationalResampler<R>(owner->intermediateRate, owner->audioSampleRate,
+                                                               std::min(AUDIO_CUTOFF, (owner->audioSampleRate - AUDIO_TRANSITION) / 2),
+                                                               AUDIO_TRANSITION,
+                                                               (double)owner->intermediateRate / GAIN_REFERENCE_RATE)),
+      stereoDecoder(options.stereo ? new StereoDecoder<R>(owner->intermediateRate, owner->audioSampleRate,
+                                                          (double)owner->intermediateRate / GAIN_REFERENCE_RATE)
+                                   : nullptr),
+      stage(&BasicFmMultiDemodulator::stationExecutor, this, &BasicFmMultiDemodulator::stationDiscontinuityHandler,
+            STATION_QUEUE_SIZE, SpscRing<DataBuffer<Sample>>::defaultSpinCount(), options.demodThread, index,
+            owner->stationBlocks.size(), options.scheduler)
+{
+}
+
+template <typename R>
+BasicFmMultiDemodulator<R>::BasicFmMultiDemodulator(DemodCallback demodCallback, int sampleRate, int audioSampleRate,
+                                                    const std::vector<int> &stationOffsets, float gain,
+                                                    const FmDemodulatorOptions &options)
+    : digitalGain(gain),
+      sampleRate(sampleRate),
+      audioSampleRate(audioSampleRate),
+      channels(chooseChannels(sampleRate)),
+      channelRate(sampleRate / (channels / 2)),
+      intermediateRate(BasicFmDemodulator<R>::chooseIntermediateRate(channelRate, audioSampleRate)),
+      demodCallback(std::move(demodCallback)),
+      iqConverter(options.removeDcOffset, options.iqScale),
+      channelizer(channels, channels / 2, sampleRate / channels,
+                  std::max(IQ_TRANSITION, sampleRate / channels - 2 * IQ_CUTOFF), sampleRate, options.plannerRigor),
+      stationBlocks(stationOffsets.size()),
+      channelOutputs(channels, nullptr),
+      discontinuity(false),
+      channelizerPool(&BasicFmMultiDemodulator::channelizerExecutor, this, options.overflowPolicy,
+                      &BasicFmMultiDemodulator::channelizerDiscontinuityHandler, 1, options.transformThread,
+                      options.scheduler)
+{
+    double spacing = (double)sampleRate / channels;
+    for (size_t i = 0; i < stationOffsets.size(); i++)
+    {
+        int nearest = (int)lround(stationOffsets[i] / spacing);
+        int channel = ((nearest % channels) + channels) % channels;
+        stations.emplace_back(new Station(this, i, channel, stationOffsets[i] - nearest * spacing, options));
+    }
+}
+
+template <typename R>
+BasicFmMultiDemodulator<R>::~BasicFmMultiDemodulator()
+{
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::demodulate(const DataBuffer<uint8_t> &buffer, size_t count)
+{
+    channelizerPool.process(DataBuffer<uint8_t>(buffer.get(), count, &inputBuffers));
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::demodulate(DataBuffer<uint8_t> &&buffer)
+{
+    channelizerPool.process(std::move(buffer));
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::demodulate(uint8_t *data, size_t count, DataBuffer<uint8_t>::ReleaseFunction release, void *arg)
+{
+    channelizerPool.process(DataBuffer<uint8_t>(data, count, release, arg));
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::channelizerExecutor(DataBuffer<uint8_t> &data, void *arg)
+{
+    BasicFmMultiDemodulator *_this = reinterpret_cast<BasicFmMultiDemodulator *>(arg);
+
+    DataBuffer<Sample> iq(data.size() / 2, &_this->iqBuffers);
+    {
+        // Owning the input here gives it back as soon as it is converted
+        DataBuffer<uint8_t> input(std::move(data));
+        _this->iqConverter.convert(input.get(), iq.size(), iq.get());
+    }
+
+    // Every used channel is written to the block of the first station on it, the other stations copy it
+    size_t outputSize = _this->channelizer.outputSize(iq.size());
+    std::fill(_this->channelOutputs.begin(), _this->channelOutputs.end(), nullptr);
+    for (size_t i = 0; i < _this->stations.size(); i++)
+    {
+        _this->stationBlocks[i].emplace(outputSize, &_this->channelBuffers);
+        Sample *&output = _this->channelOutputs[_this->stations[i]->channel];
+        if (output == nullptr)
+        {
+            output = _this->stationBlocks[i]->get();
+        }
+    }
+    _this->channelizer.channelize(iq.get(), iq.size(), _this->channelOutputs.data());
+
+    bool blockDiscontinuity = std::exchange(_this->discontinuity, false);
+    for (size_t i = 0; i < _this->stations.size(); i++)
+    {
+        Station &station = *_this->stations[i];
+        Sample *channel = _this->channelOutputs[station.channel];
+        if (channel != _this->stationBlocks[i]->get())
+        {
+            memcpy(_this->stationBlocks[i]->get(), channel, sizeof(Sample) * outputSize);
+        }
+    }
+    for (size_t i = 0; i < _this->stations.size(); i++)
+    {
+        _this->stations[i]->stage.process(std::move(*_this->stationBlocks[i]), blockDiscontinuity);
+        _this->stationBlocks[i].reset();
+    }
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::channelizerDiscontinuityHandler(void *arg)
+{
+    BasicFmMultiDemodulator *_this = reinterpret_cast<BasicFmMultiDemodulator *>(arg);
+    _this->channelizer.reset();
+    _this->discontinuity = true;
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::stationExecutor(DataBuffer<Sample> &data, void *arg)
+{
+    Station &station = *reinterpret_cast<Station *>(arg);
+    BasicFmMultiDemodulator *owner = station.owner;
+
+    float dGain = owner->digitalGain.load(std::memory_order_relaxed);
+
+    station.nco.shift(data.get(), data.size());
+
+    // Lowpass 100kHz and resample to the FM demodulation sample rate
+    DataBuffer<Sample> resampled = station.iqResampler.resample(data, &station.buffers);
+
+    DataBuffer<R> demodulatedBuffer(resampled.size(), &station.buffers);
+    station.discriminator.demodulate(resampled.get(), resampled.size(), demodulatedBuffer.get());
+
+    if (station.stereoDecoder)
+    {
+        // Recover L+R and L-R, lowpass both and resample them to the audio sample rate in one pass
+        size_t frames = station.stereoDecoder->outputSize(demodulatedBuffer.size());
+        DataBuffer<R> stereoDs(2 * frames, &station.buffers);
+        station.stereoDecoder->decode(demodulatedBuffer.get(), demodulatedBuffer.size(), stereoDs.get());
+
+        DataBuffer<int16_t> audioBuffer(stereoDs.size(), &station.buffers);
+        for (size_t i = 0; i < stereoDs.size(); i++)
+        {
+            audioBuffer[i] = coerceToInt16(stereoDs[i] * dGain);
+        }
+
+        owner->demodCallback(station.index, audioBuffer);
+        return;
+    }
+
+    // Lowpass 20kHz and resample to the audio sample rate
+    DataBuffer<R> demodDs = station.audioResampler->resample(demodulatedBuffer, &station.buffers);
+
+    DataBuffer<int16_t> audioBuffer(demodDs.size(), &station.buffers);
+    for (size_t i = 0; i < demodDs.size(); i++)
+    {
+        audioBuffer[i] = coerceToInt16(demodDs[i] * dGain);
+    }
+
+    owner->demodCallback(station.index, audioBuffer);
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::stationDiscontinuityHandler(void *arg)
+{
+    Station &station = *reinterpret_cast<Station *>(arg);
+    station.iqResampler.reset();
+    station.discriminator.reset();
+    if (station.audioResampler)
+    {
+        station.audioResampler->reset();
+    }
+    if (station.stereoDecoder)
+    {
+        station.stereoDecoder->reset();
+    }
+}
+
+template <typename R>
+void BasicFmMultiDemodulator<R>::setDigitalGain(float gain)
+{
+    this->digitalGain.store(gain, std::memory_order_relaxed);
+}
+
+template <typename R>
+float BasicFmMultiDemodulator<R>::getDigitalGain() const
+{
+    return this->digitalGain;
+}
+
+template <typename R>
+size_t BasicFmMultiDemodulator<R>::getStationCount() const
+{
+    return stations.size();
+}
+
+template <typename R>
+bool BasicFmMultiDemodulator<R>::isStereo(size_t station) const
+{
+    return stations[station]->stereoDecoder && stations[station]->stereoDecoder->isStereo();
+}
+
+template <typename R>
+int BasicFmMultiDemodulator<R>::getChannelRate() const
+{
+    return channelRate;
+}
+
+template <typename R>
+int BasicFmMultiDemodulator<R>::getIntermediateRate() const
+{
+    return intermediateRate;
+}
+
+template <typename R>
+bool BasicFmMultiDemodulator<R>::isThreadConfigApplied() const
+{
+    bool applied = channelizerPool.isThreadConfigApplied();
+    for (const std::unique_ptr<Station> &station : stations)
+    {
+        applied &= station->stage.isThreadConfigApplied();
+    }
+    return applied;
+}
+
+template <typename R>
+QueueStats BasicFmMultiDemodulator<R>::getQueueStats() const
+{
+    return channelizerPool.getStats();
+}
+
+template <typename R>
+int BasicFmMultiDemodulator<R>::chooseChannels(int sampleRate)
+{
+    // The channels are decimated by half their number, which must divide the sample rate for the
+    // channel rate to be exact. Two channels always qualify
+    int channels = std::max(2, sampleRate / MIN_CHANNEL_SPACING / 2 * 2);
+    while (channels > 2 && sampleRate % (channels / 2) != 0)
+    {
+        channels -= 2;
+    }
+    return channels;
+}
+
+template class BasicFmMultiDemodulator<double>;
+template class BasicFmMultiDemodulator<float>;
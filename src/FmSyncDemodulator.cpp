@@ -0,0 +1,145 @@
+#include "FmSyncDemodulator.h"
+
+#include <utility>
+
+template <typename R>
+BasicFmSyncDemodulator<R>::BasicFmSyncDemodulator(std::function<void(const DataBuffer<int16_t> &)> demodCallback,
+                                                  int sampleRate, int audioSampleRate, float gain,
+                                                  const FmDemodulatorOptions &options)
+    : sampleRate(sampleRate),
+      audioSampleRate(audioSampleRate),
+      intermediateRate(BasicFmDemodulator<R>::chooseIntermediateRate(sampleRate, audioSampleRate)),
+      digitalGain(gain),
+      frequencyOffset(options.frequencyOffset),
+      demodCallback(std::move(demodCallback)),
+      iqConverter(options.removeDcOffset, options.iqScale),
+      nco(-options.frequencyOffset, sampleRate),
+      iqResampler(sampleRate, intermediateRate, IQ_CUTOFF, IQ_TRANSITION),
+      discriminator(options.discriminator),
+      audioResampler(options.stereo ? nullptr
+                                    : new RationalResampler<R>(intermediateRate, audioSampleRate,
+                                                               std::min(AUDIO_CUTOFF, (audioSampleRate - AUDIO_TRANSITION) / 2),
+                                                               AUDIO_TRANSITION, (double)intermediateRate / GAIN_REFERENCE_RATE)),
+      stereoDecoder(options.stereo ? new StereoDecoder<R>(intermediateRate, audioSampleRate,
+                                                          (double)intermediateRate / GAIN_REFERENCE_RATE)
+                                   : nullptr),
+      iqTile(TILE_SIZE)
+{
+    // A tile produces at most one more output than its share of the rate ratio
+    size_t resampled = TILE_SIZE * (size_t)intermediateRate / sampleRate + 2;
+    resampledTile.resize(resampled);
+    demodulatedTile.resize(resampled);
+    audioTile.resize(2 * (resampled * (size_t)audioSampleRate / intermediateRate + 2));
+}
+
+template <typename R>
+void BasicFmSyncDemodulator<R>::demodulate(const DataBuffer<uint8_t> &buffer, size_t count)
+{
+    demodulate(buffer.get(), count);
+}
+
+template <typename R>
+void BasicFmSyncDemodulator<R>::demodulate(const uint8_t *data, size_t count)
+{
+    size_t samples = count / 2;
+    size_t resampled = iqResampler.outputSize(samples);
+    size_t audioSize = stereoDecoder ? 2 * stereoDecoder->outputSize(resampled) : audioResampler->outputSize(resampled);
+
+    DataBuffer<int16_t> audioBuffer(audioSize, &audioBuffers);
+    size_t written = 0;
+    for (size_t i = 0; i < samples; i += TILE_SIZE)
+    {
+        size_t n = std::min(TILE_SIZE, samples - i);
+        written += demodulateTile(data + 2 * i, n, audioBuffer.get() + written);
+    }
+
+    demodCallback(audioBuffer);
+}
+
+template <typename R>
+size_t BasicFmSyncDemodulator<R>::demodulateTile(const uint8_t *data, size_t count, int16_t *audio)
+{
+    // Transform data by subtracting 128 (ADC middle point), or the DC offset, converting to complex
+    // and shifting the station to DC
+    iqConverter.convert(data, count, iqTile.data(), nco);
+
+    // Lowpass 100kHz and resample to the FM demodulation sample rate
+    size_t resampled = iqResampler.outputSize(count);
+    iqResampler.resample(iqTile.data(), count, resampledTile.data());
+
+    discriminator.demodulate(resampledTile.data(), resampled, demodulatedTile.data());
+
+    // Lowpass and resample to the audio sample rate, L+R and L-R in one pass when decoding stereo
+    size_t audioSize;
+    if (stereoDecoder)
+    {
+        audioSize = 2 * stereoDecoder->outputSize(resampled);
+        stereoDecoder->decode(demodulatedTile.data(), resampled, audioTile.data());
+    }
+    else
+    {
+        audioSize = audioResampler->outputSize(resampled);
+        audioResampler->resample(demodulatedTile.data(), resampled, audioTile.data());
+    }
+
+    for (size_t i = 0; i < audioSize; i++)
+    {
+        audio[i] = coerceToInt16(audioTile[i] * digitalGain);
+    }
+    return audioSize;
+}
+
+template <typename R>
+void BasicFmSyncDemodulator<R>::reset()
+{
+    iqResampler.reset();
+    discriminator.reset();
+    if (audioResampler)
+    {
+        audioResampler->reset();
+    }
+    if (stereoDecoder)
+    {
+        stereoDecoder->reset();
+    }
+}
+
+template <typename R>
+void BasicFmSyncDemodulator<R>::setDigitalGain(float gain)
+{
+    this->digitalGain = gain;
+}
+
+template <typename R>
+void BasicFmSyncDemodulator<R>::setFrequencyOffset(int offset)
+{
+    this->frequencyOffset = offset;
+    nco.setFrequency(-offset, sampleRate);
+}
+
+template <typename R>
+float BasicFmSyncDemodulator<R>::getDigitalGain() const
+{
+    return this->digitalGain;
+}
+
+template <typename R>
+int BasicFmSyncDemodulator<R>::getFrequencyOffset() const
+{
+    return this->frequencyOffset;
+}
+
+template <typename R>
+int BasicFmSyncDemodulator<R>::getIntermediateRate() const
+{
+    return intermediateRate;
+}
+
+template <typename R>
+bool BasicFmSyncDemodulator<R>::isStereo() const
+{
+    return stereoDecoder && stereoDecoder->isStereo();
+}
+
+template class BasicFmSyncDemodulator<double>;
+template class BasicFmSyncDemodulator<float>;
@@ -0,0 +1,130 @@
+/*
+ * FmFileDemodulatorTest.cpp
+ *
+ * The offline engine must produce the audio of the streaming pipeline with the same settings,
+ * whatever the chunk size: demodulates a synthetic off-center station with both and compares
+ * the samples. Also checks that stereo decoding is refused.
+ *
+ * Usage: FmFileDemodulatorTest
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DataBuffer.h"
+#include "FmDemodulator.h"
+#include "FmFileDemodulator.h"
+
+static constexpr int SAMPLE_RATE = 1024000;
+static constexpr int AUDIO_SAMPLE_RATE = 48000;
+static constexpr int FREQUENCY_OFFSET = 150000;
+static constexpr double DURATION = 1.5;
+static constexpr float GAIN = 3000.0f;
+// Bytes pushed at a time to the streaming pipeline, not a multiple of any chunk size
+static constexpr size_t STREAM_BLOCK = 2 * 100003;
+
+/**
+ * @brief 8 bit IQ recording of a 1 kHz tone with 75 kHz deviation at `FREQUENCY_OFFSET`, with some noise
+ */
+static std::vector<uint8_t> makeRecording()
+{
+    size_t samples = (size_t)(SAMPLE_RATE * DURATION);
+    std::vector<uint8_t> recording(2 * samples);
+    double phase = 0;
+    unsigned seed = 7;
+    for (size_t n = 0; n < samples; n++)
+    {
+        double t = (double)n / SAMPLE_RATE;
+        phase += 2 * M_PI * (FREQUENCY_OFFSET + 75000 * sin(2 * M_PI * 1000 * t)) / SAMPLE_RATE;
+        seed = seed * 1103515245 + 12345;
+        double noise = ((seed >> 16) % 100) / 50.0 - 1;
+        recording[2 * n] = (uint8_t)lround(127.5 + 100 * cos(phase) + noise);
+        recording[2 * n + 1] = (uint8_t)lround(127.5 + 100 * sin(phase) + noise);
+    }
+    return recording;
+}
+
+/**
+ * @brief Demodulate the recording with the streaming pipeline, waiting for `expected` audio samples
+ */
+static std::vector<int16_t> demodulateStream(const std::vector<uint8_t> &recording, const FmDemodulatorOptions &options,
+                                             size_t expected)
+{
+    std::vector<int16_t> audio;
+    std::mutex mtx;
+    FmDemodulator demodulator([&](const DataBuffer<int16_t> &buffer)
+                              {
+                                  std::lock_guard<std::mutex> lock(mtx);
+                                  audio.insert(audio.end(), buffer.get(), buffer.get() + buffer.size());
+                              },
+                              SAMPLE_RATE, AUDIO_SAMPLE_RATE, GAIN, options);
+
+    for (size_t i = 0; i < recording.size(); i += STREAM_BLOCK)
+    {
+        size_t count = std::min(STREAM_BLOCK, recording.size() - i);
+        demodulator.demodulate(DataBuffer<uint8_t>(recording.data() + i, count), count);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (audio.size() >= expected)
+            {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    return audio;
+}
+
+int main()
+{
+    std::vector<uint8_t> recording = makeRecording();
+    FmDemodulatorOptions options;
+    options.frequencyOffset = FREQUENCY_OFFSET;
+    // Every block must reach the audio to compare the whole recording
+    options.overflowPolicy = OverflowPolicy::Block;
+
+    std::vector<int16_t> reference;
+    int failures = 0;
+    for (size_t chunkSize : {(size_t)10007, (size_t)65536, (size_t)300000, (size_t)1 << 22})
+    {
+        FmFileDemodulator fileDemodulator(SAMPLE_RATE, AUDIO_SAMPLE_RATE, GAIN, options, 4, chunkSize);
+        std::vector<int16_t> audio;
+        bool ok = fileDemodulator.demodulate(recording.data(), recording.size(), [&](const DataBuffer<int16_t> &buffer)
+                                             { audio.insert(audio.end(), buffer.get(), buffer.get() + buffer.size()); });
+
+        if (reference.empty())
+        {
+            reference = demodulateStream(recording, options, audio.size());
+        }
+
+        size_t differing = 0;
+        for (size_t i = 0; i < std::min(audio.size(), reference.size()); i++)
+        {
+            differing += audio[i] != reference[i];
+        }
+        bool passed = ok && !audio.empty() && audio.size() == reference.size() && differing == 0;
+        printf("chunk %zu: %zu samples, streaming %zu, %zu differing: %s\n", chunkSize, audio.size(), reference.size(),
+               differing, passed ? "ok" : "FAILED");
+        failures += !passed;
+    }
+
+    FmDemodulatorOptions stereoOptions = options;
+    stereoOptions.stereo = true;
+    FmFileDemodulator stereoDemodulator(SAMPLE_RATE, AUDIO_SAMPLE_RATE, GAIN, stereoOptions);
+    bool refused = !stereoDemodulator.demodulate(recording.data(), recording.size(), [](const DataBuffer<int16_t> &) {});
+    printf("stereo refused: %s\n", refused ? "ok" : "FAILED");
+    failures += !refused;
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
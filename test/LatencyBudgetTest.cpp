@@ -0,0 +1,127 @@
+/*
+ * LatencyBudgetTest.cpp
+ *
+ * Slicing the blocks to meet a latency budget must not change the audio: demodulates the same
+ * synthetic off-center station without a budget and with several budgets, pushing either large
+ * blocks, sliced by the pipeline, or the blocks of `inputBlockSize`, and compares the samples.
+ *
+ * Usage: LatencyBudgetTest
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DataBuffer.h"
+#include "FmDemodulator.h"
+#include "FmFileDemodulator.h"
+
+static constexpr int SAMPLE_RATE = 1024000;
+static constexpr int AUDIO_SAMPLE_RATE = 48000;
+static constexpr int FREQUENCY_OFFSET = 150000;
+static constexpr double DURATION = 1.5;
+static constexpr float GAIN = 3000.0f;
+// Bytes pushed at a time without a budget, and with a budget to let the pipeline slice them
+static constexpr size_t LARGE_BLOCK = 2 * 100003;
+
+/**
+ * @brief 8 bit IQ recording of a 1 kHz tone with 75 kHz deviation at `FREQUENCY_OFFSET`, with some noise
+ */
+static std::vector<uint8_t> makeRecording()
+{
+    size_t samples = (size_t)(SAMPLE_RATE * DURATION);
+    std::vector<uint8_t> recording(2 * samples);
+    double phase = 0;
+    unsigned seed = 7;
+    for (size_t n = 0; n < samples; n++)
+    {
+        double t = (double)n / SAMPLE_RATE;
+        phase += 2 * M_PI * (FREQUENCY_OFFSET + 75000 * sin(2 * M_PI * 1000 * t)) / SAMPLE_RATE;
+        seed = seed * 1103515245 + 12345;
+        double noise = ((seed >> 16) % 100) / 50.0 - 1;
+        recording[2 * n] = (uint8_t)lround(127.5 + 100 * cos(phase) + noise);
+        recording[2 * n + 1] = (uint8_t)lround(127.5 + 100 * sin(phase) + noise);
+    }
+    return recording;
+}
+
+/**
+ * @brief Demodulate the recording pushed in blocks of `block` bytes, waiting for `expected` audio samples
+ */
+static std::vector<int16_t> demodulateStream(const std::vector<uint8_t> &recording, const FmDemodulatorOptions &options,
+                                             size_t block, size_t expected)
+{
+    std::vector<int16_t> audio;
+    std::mutex mtx;
+    FmDemodulator demodulator([&](const DataBuffer<int16_t> &buffer)
+                              {
+                                  std::lock_guard<std::mutex> lock(mtx);
+                                  audio.insert(audio.end(), buffer.get(), buffer.get() + buffer.size());
+                              },
+                              SAMPLE_RATE, AUDIO_SAMPLE_RATE, GAIN, options);
+
+    for (size_t i = 0; i < recording.size(); i += block)
+    {
+        size_t count = std::min(block, recording.size() - i);
+        demodulator.demodulate(DataBuffer<uint8_t>(recording.data() + i, count), count);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (audio.size() >= expected)
+            {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    return audio;
+}
+
+int main()
+{
+    std::vector<uint8_t> recording = makeRecording();
+    FmDemodulatorOptions options;
+    options.frequencyOffset = FREQUENCY_OFFSET;
+    // Every block must reach the audio to compare the whole recording
+    options.overflowPolicy = OverflowPolicy::Block;
+
+    // The offline engine gives the length of the audio, to know when the pipeline is done
+    std::vector<int16_t> offline;
+    FmFileDemodulator(SAMPLE_RATE, AUDIO_SAMPLE_RATE, GAIN, options)
+        .demodulate(recording.data(), recording.size(), [&](const DataBuffer<int16_t> &buffer)
+                    { offline.insert(offline.end(), buffer.get(), buffer.get() + buffer.size()); });
+
+    std::vector<int16_t> reference = demodulateStream(recording, options, LARGE_BLOCK, offline.size());
+    printf("no budget: %zu samples\n", reference.size());
+
+    int failures = reference.size() != offline.size();
+    for (double budget : {0.005, 0.02, 0.1})
+    {
+        FmDemodulatorOptions sliced = options;
+        sliced.latencyBudget = budget;
+        for (size_t block : {LARGE_BLOCK, FmDemodulator::inputBlockSize(budget, SAMPLE_RATE)})
+        {
+            std::vector<int16_t> audio = demodulateStream(recording, sliced, block, reference.size());
+            size_t differing = 0;
+            for (size_t i = 0; i < std::min(audio.size(), reference.size()); i++)
+            {
+                differing += audio[i] != reference[i];
+            }
+            bool passed = !audio.empty() && audio.size() == reference.size() && differing == 0;
+            printf("budget %g s, blocks of %zu bytes: %zu samples, %zu differing: %s\n", budget, block, audio.size(),
+                   differing, passed ? "ok" : "FAILED");
+            failures += !passed;
+        }
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+/*
+ * StereoDecoderTest.cpp
+ *
+ * The stereo decoder must separate the channels of a standard multiplex signal (ITU-R BS.450:
+ * sin pilot, sin subcarrier): a tone on the left only must come out of the left channel, and
+ * the right channel must stay below it by the expected separation. Checked on the decoder alone,
+ * on the multiplex signal the discriminator produces, and through the whole demodulation.
+ *
+ * Usage: StereoDecoderTest
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "DataBuffer.h"
+#include "StereoDecoder.h"
+#include "FmDemodulator.h"
+#include "FmSyncDemodulator.h"
+
+static constexpr int MPX_SAMPLE_RATE = 220000;
+static constexpr int SAMPLE_RATE = 1024000;
+static constexpr int AUDIO_SAMPLE_RATE = 48000;
+static constexpr double TONE = 1000;
+static constexpr double DURATION = 2.0;
+// The PLL locks and the blend settles during the first half second, which is not measured
+static constexpr double SETTLING = 0.5;
+static constexpr double DECODER_SEPARATION_DB = 50;
+// The discriminator and the IQ filter add crosstalk before the decoder
+static constexpr double PIPELINE_SEPARATION_DB = 20;
+
+/**
+ * @brief Standard multiplex signal at time `t`, with a tone on the left or on the right channel,
+ * normalized to the full deviation
+ */
+static double multiplex(double t, bool left, bool pilot)
+{
+    double tone = sin(2 * M_PI * TONE * t);
+    double l = left ? tone : 0, r = left ? 0 : tone;
+    double mpx = 0.45 * (l + r) / 2 + 0.45 * (l - r) / 2 * sin(2 * M_PI * 38000 * t);
+    return pilot ? mpx + 0.09 * sin(2 * M_PI * 19000 * t) : mpx;
+}
+
+/**
+ * @brief Power of the tone in the channel `channel` of interleaved stereo audio, after the settling time
+ */
+static double tonePower(const std::vector<double> &audio, int channel)
+{
+    double c = 0, s = 0;
+    size_t n = 0;
+    for (size_t i = (size_t)(SETTLING * AUDIO_SAMPLE_RATE); 2 * i + 1 < audio.size(); i++, n++)
+    {
+        double phase = 2 * M_PI * TONE * i / AUDIO_SAMPLE_RATE;
+        c += audio[2 * i + channel] * cos(phase);
+        s += audio[2 * i + channel] * sin(phase);
+    }
+    return n > 0 ? (c * c + s * s) / ((double)n * n) : 0;
+}
+
+/**
+ * @brief Print and check the separation of the decoded audio
+ *
+ * @return The number of failed checks
+ */
+static int check(const char *name, const std::vector<double> &audio, bool left, bool stereo, double minimum)
+{
+    double wanted = tonePower(audio, left ? 0 : 1), crosstalk = tonePower(audio, left ? 1 : 0);
+    double separation = 10 * log10(wanted / std::max(crosstalk, 1e-30));
+    bool passed = stereo && separation >= minimum;
+    printf("%s, %s only: stereo %d, separation %.1f dB: %s\n", name, left ? "left" : "right", stereo, separation,
+           passed ? "ok" : "FAILED");
+    return !passed;
+}
+
+/**
+ * @brief Decode the multiplex signal of the discriminator output directly
+ */
+static int testDecoder(bool left)
+{
+    size_t samples = (size_t)(MPX_SAMPLE_RATE * DURATION);
+    std::vector<double> mpx(samples);
+    for (size_t n = 0; n < samples; n++)
+    {
+        // The discriminator gives the phase difference in radians per sample
+        mpx[n] = 2 * M_PI * 75000 * multiplex((double)n / MPX_SAMPLE_RATE, left, true) / MPX_SAMPLE_RATE;
+    }
+
+    StereoDecoder<double> decoder(MPX_SAMPLE_RATE, AUDIO_SAMPLE_RATE);
+    std::vector<double> audio;
+    static constexpr size_t BLOCK = 10000;
+    for (size_t i = 0; i < samples; i += BLOCK)
+    {
+        size_t count = std::min(BLOCK, samples - i);
+        std::vector<double> output(2 * decoder.outputSize(count));
+        decoder.decode(mpx.data() + i, count, output.data());
+        audio.insert(audio.end(), output.begin(), output.end());
+    }
+    return check("decoder", audio, left, decoder.isStereo(), DECODER_SEPARATION_DB);
+}
+
+/**
+ * @brief Demodulate a synthetic 8 bit IQ broadcast with stereo decoding
+ */
+static int testPipeline(bool left, bool pilot)
+{
+    size_t samples = (size_t)(SAMPLE_RATE * DURATION);
+    std::vector<uint8_t> iq(2 * samples);
+    double phase = 0;
+    for (size_t n = 0; n < samples; n++)
+    {
+        phase = remainder(phase + 2 * M_PI * 75000 * multiplex((double)n / SAMPLE_RATE, left, pilot) / SAMPLE_RATE,
+                          2 * M_PI);
+        iq[2 * n] = (uint8_t)lround(127.5 + 100 * cos(phase));
+        iq[2 * n + 1] = (uint8_t)lround(127.5 + 100 * sin(phase));
+    }
+
+    FmDemodulatorOptions options;
+    options.stereo = true;
+    std::vector<double> audio;
+    FmSyncDemodulator demodulator([&](const DataBuffer<int16_t> &buffer)
+                                  { audio.insert(audio.end(), buffer.get(), buffer.get() + buffer.size()); },
+                                  SAMPLE_RATE, AUDIO_SAMPLE_RATE, 1000.0f, options);
+    static constexpr size_t BLOCK = 65536;
+    for (size_t i = 0; i < samples; i += BLOCK)
+    {
+        size_t count = std::min(BLOCK, samples - i);
+        demodulator.demodulate(iq.data() + 2 * i, 2 * count);
+    }
+
+    if (!pilot)
+    {
+        bool passed = !demodulator.isStereo();
+        printf("pipeline, no pilot: stereo %d: %s\n", demodulator.isStereo(), passed ? "ok" : "FAILED");
+        return !passed;
+    }
+    return check("pipeline", audio, left, demodulator.isStereo(), PIPELINE_SEPARATION_DB);
+}
+
+int main()
+{
+    int failures = 0;
+    failures += testDecoder(true);
+    failures += testDecoder(false);
+    failures += testPipeline(true, true);
+    failures += testPipeline(false, true);
+    failures += testPipeline(true, false);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}